@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "compiler.h"
+#include "bytecode.h"
+#include "memo.h"
+#include "profile.h"
+
+using namespace std;
+
+struct Lowering
+{
+    BytecodeProgram* program;
+    map<InstructionNode*, int> placed;          // node -> index in program->code
+    map<Function*, int> function_ids;
+    vector<pair<int, InstructionNode*> > fixups; // jump index -> target node
+    vector<pair<int, InstructionNode*> > successor_fixups; // CJMP index -> node run when the condition holds
+    vector<pair<int, InstructionNode*> > case_fixups; // case_targets index -> target node
+    vector<InstructionNode*> pending;            // jump targets not yet placed
+    int frame_size;                              // frame of the body being lowered
+};
+
+static int function_id(Lowering& lowering, struct Function* function)
+{
+    map<Function*, int>::iterator it = lowering.function_ids.find(function);
+    if (it != lowering.function_ids.end())
+        return it->second;
+
+    BytecodeFunction entry;
+    entry.function = function;
+    entry.frame_template = &function->localMem[0];
+    entry.frame_size = function->localMem.size();
+    entry.entry = -1;
+    entry.cache = NULL;
+    if (memoization && function->pure)
+        entry.cache = new_memo_cache(function->name.c_str(), function->parameter_count);
+    lowering.program->functions.push_back(entry);
+    int id = lowering.program->functions.size() - 1;
+    lowering.function_ids[function] = id;
+    return id;
+}
+
+static void add_jump(Lowering& lowering, int index, struct InstructionNode* target)
+{
+    if (target == NULL)
+    {
+        debug("Error: jump target is null.\n");
+        exit(EXIT_FAILURE);
+    }
+    lowering.fixups.push_back(make_pair(index, target));
+    lowering.pending.push_back(target);
+}
+
+static bool case_less(const SwitchCase& a, const SwitchCase& b)
+{
+    return a.value < b.value;
+}
+
+/*
+ * Cases whose values cover at least a third of their range get a table
+ * indexed by the value, where the gaps go to the default. Others are kept
+ * sorted for a binary search.
+ */
+static void lower_switch(Lowering& lowering, struct InstructionNode* node, int index, Instruction& inst)
+{
+    BytecodeProgram* program = lowering.program;
+    vector<SwitchCase> cases = *node->switch_inst.cases;
+    sort(cases.begin(), cases.end(), case_less);
+
+    inst.a = node->switch_inst.operand_index;
+    inst.b = program->case_targets.size();
+    inst.target = index + 1;
+
+    long long range = cases.empty() ? 0 : (long long) cases.back().value - cases.front().value + 1;
+    if (!cases.empty() && range <= 3 * (long long) cases.size())
+    {
+        inst.opcode = OP_SWITCH_TABLE;
+        inst.c = cases.front().value;
+        inst.d = range;
+        for (int i = 0, c = 0; i < range; i++)
+        {
+            program->case_values.push_back(inst.c + i);
+            if (cases[c].value == inst.c + i)
+            {
+                lowering.case_fixups.push_back(make_pair((int) program->case_targets.size(), cases[c].target));
+                lowering.pending.push_back(cases[c].target);
+                c++;
+            }
+            program->case_targets.push_back(index + 1);
+        }
+    }
+    else
+    {
+        inst.opcode = OP_SWITCH_SEARCH;
+        inst.d = cases.size();
+        for (int i = 0; i < cases.size(); i++)
+        {
+            program->case_values.push_back(cases[i].value);
+            lowering.case_fixups.push_back(make_pair((int) program->case_targets.size(), cases[i].target));
+            lowering.pending.push_back(cases[i].target);
+            program->case_targets.push_back(-1);
+        }
+    }
+}
+
+Opcode assign_opcode(ArithmeticOperatorType op)
+{
+    switch (op)
+    {
+        case OPERATOR_NONE:  return OP_ASSIGN_NONE;
+        case OPERATOR_PLUS:  return OP_ASSIGN_PLUS;
+        case OPERATOR_MINUS: return OP_ASSIGN_MINUS;
+        case OPERATOR_MULT:  return OP_ASSIGN_MULT;
+        case OPERATOR_DIV:   return OP_ASSIGN_DIV;
+    }
+    debug("Error: invalid value for assign_inst.op (%d).\n", op);
+    exit(EXIT_FAILURE);
+}
+
+Opcode cjmp_opcode(ConditionalOperatorType condition_op)
+{
+    switch (condition_op)
+    {
+        case CONDITION_GREATER:  return OP_CJMP_GREATER;
+        case CONDITION_LESS:     return OP_CJMP_LESS;
+        case CONDITION_NOTEQUAL: return OP_CJMP_NOTEQUAL;
+    }
+    debug("Error: invalid value for cjmp_inst.condition_op (%d).\n", condition_op);
+    exit(EXIT_FAILURE);
+}
+
+static Instruction lower_node(Lowering& lowering, struct InstructionNode* node, int index)
+{
+    Instruction inst;
+    inst.handler = NULL;
+    inst.a = inst.b = inst.c = inst.d = 0;
+    inst.target = -1;
+
+    switch (node->type)
+    {
+        case NOOP:
+            inst.opcode = OP_NOOP;
+            break;
+        case PRINTIN:
+            inst.opcode = OP_PRINT;
+            inst.a = node->print_inst.var_index;
+            break;
+        case ASSIGN:
+            inst.opcode = assign_opcode(node->assign_inst.op);
+            inst.a = node->assign_inst.left_hand_side_index;
+            inst.b = node->assign_inst.operand1_index;
+            inst.c = node->assign_inst.operand2_index;
+            break;
+        case CJMP:
+            inst.opcode = cjmp_opcode(node->cjmp_inst.condition_op);
+            inst.b = node->cjmp_inst.operand1_index;
+            inst.c = node->cjmp_inst.operand2_index;
+            add_jump(lowering, index, node->cjmp_inst.target);
+            // Falling off the end of the body is the instruction lower_chain
+            // puts right after
+            inst.a = index + 1;
+            if (node->next != NULL)
+                lowering.successor_fixups.push_back(make_pair(index, node->next));
+            break;
+        case JMP:
+            inst.opcode = OP_JMP;
+            add_jump(lowering, index, node->jmp_inst.target);
+            break;
+        case SWITCHJMP:
+            lower_switch(lowering, node, index, inst);
+            break;
+        case FUNCTION:
+        case TAILCALL:
+            inst.target = function_id(lowering, node->function_inst.function);
+            if (node->type == FUNCTION)
+            {
+                const BytecodeFunction& callee = lowering.program->functions[inst.target];
+                bool cached = callee.cache != NULL &&
+                              node->function_inst.operators->size() == callee.function->parameter_count;
+                inst.opcode = cached ? OP_CALL_MEMO : OP_CALL;
+                inst.a = node->function_inst.result_index;
+                inst.d = lowering.frame_size + FRAME_HEADER;
+            }
+            else
+            {
+                inst.opcode = OP_TAILCALL;
+                inst.d = lowering.frame_size;
+            }
+            inst.b = lowering.program->arguments.size();
+            inst.c = node->function_inst.operators->size();
+            lowering.program->arguments.insert(lowering.program->arguments.end(),
+                node->function_inst.operators->begin(), node->function_inst.operators->end());
+            break;
+        default:
+            debug("Error: invalid value for node->type (%d).\n", node->type);
+            exit(EXIT_FAILURE);
+    }
+    return inst;
+}
+
+/*
+ * Node laid out after node: its next, unless node is a CJMP that the profile
+ * says mostly jumps to its target, in which case the target comes first and
+ * the next waits with the other jump targets.
+ */
+static struct InstructionNode* layout_successor(Lowering& lowering, struct InstructionNode* node)
+{
+    if (node->type != CJMP || node->next == NULL || !profile_prefers_target(node) ||
+        lowering.placed.find(node->cjmp_inst.target) != lowering.placed.end())
+        return node->next;
+    lowering.pending.push_back(node->next);
+    return node->cjmp_inst.target;
+}
+
+/*
+ * Lays out the chain starting at node. The chain is followed through
+ * layout_successor until it ends, where "end" (OP_RET or OP_HALT) is
+ * emitted, or until it reaches a node that was already placed, where a jump
+ * to it is emitted.
+ */
+static void lower_chain(Lowering& lowering, struct InstructionNode* node, Opcode end)
+{
+    vector<Instruction>& code = lowering.program->code;
+    Instruction inst;
+    inst.handler = NULL;
+    inst.a = inst.b = inst.c = inst.d = 0;
+    inst.target = -1;
+
+    while (node != NULL)
+    {
+        map<InstructionNode*, int>::iterator it = lowering.placed.find(node);
+        if (it != lowering.placed.end())
+        {
+            inst.opcode = OP_JMP;
+            inst.target = it->second;
+            code.push_back(inst);
+            lowering.program->nodes.push_back(NULL);
+            return;
+        }
+
+        int index = code.size();
+        lowering.placed[node] = index;
+        code.push_back(lower_node(lowering, node, index));
+        lowering.program->nodes.push_back(node);
+        node = layout_successor(lowering, node);
+    }
+
+    inst.opcode = end;
+    code.push_back(inst);
+    lowering.program->nodes.push_back(NULL);
+}
+
+static void lower_body(Lowering& lowering, struct InstructionNode* body, int frame_size, Opcode end)
+{
+    lowering.frame_size = frame_size;
+    lowering.pending.clear();
+    lower_chain(lowering, body, end);
+
+    // Jump targets that are not reachable through next (the bodies of switch
+    // cases) are laid out after the main chain of the body.
+    while (!lowering.pending.empty())
+    {
+        struct InstructionNode* node = lowering.pending.back();
+        lowering.pending.pop_back();
+        if (lowering.placed.find(node) == lowering.placed.end())
+            lower_chain(lowering, node, end);
+    }
+}
+
+struct BytecodeProgram* lower_program(struct InstructionNode* program)
+{
+    Lowering lowering;
+    lowering.program = new BytecodeProgram;
+    lowering.program->entry = 0;
+
+    lowering.program->frame_template = main_function->localMem.data();
+    lowering.program->frame_size = main_function->localMem.size();
+    lower_body(lowering, program, lowering.program->frame_size, OP_HALT);
+
+    // Functions are discovered through the calls made to them, so the list
+    // can grow while it is being lowered.
+    for (int i = 0; i < lowering.program->functions.size(); i++)
+    {
+        int entry = lowering.program->code.size();
+        lowering.program->functions[i].entry = entry;
+        lower_body(lowering, lowering.program->functions[i].function->body,
+                   lowering.program->functions[i].frame_size, OP_RET);
+    }
+
+    for (int i = 0; i < lowering.fixups.size(); i++)
+    {
+        lowering.program->code[lowering.fixups[i].first].target =
+            lowering.placed[lowering.fixups[i].second];
+    }
+    for (int i = 0; i < lowering.successor_fixups.size(); i++)
+    {
+        lowering.program->code[lowering.successor_fixups[i].first].a =
+            lowering.placed[lowering.successor_fixups[i].second];
+    }
+    for (int i = 0; i < lowering.case_fixups.size(); i++)
+    {
+        lowering.program->case_targets[lowering.case_fixups[i].first] =
+            lowering.placed[lowering.case_fixups[i].second];
+    }
+
+    return lowering.program;
+}
+
+static bool is_cjmp(int opcode)
+{
+    return opcode == OP_CJMP_GREATER || opcode == OP_CJMP_LESS || opcode == OP_CJMP_NOTEQUAL;
+}
+
+/*
+ * Peephole pass over the shapes the parser always produces. Loops end with
+ * a JMP back to their CJMP (and for loops with the increment right before
+ * it), and every if, while and for ends with a NOOP that is only there to be
+ * jumped to.
+ */
+void fuse_superinstructions(struct BytecodeProgram* program)
+{
+    vector<Instruction>& code = program->code;
+
+    // Jumps to a NOOP go to the first instruction after it instead
+    for (int i = 0; i < code.size(); i++)
+    {
+        if (is_cjmp(code[i].opcode) || code[i].opcode == OP_JMP)
+        {
+            while (code[code[i].target].opcode == OP_NOOP)
+                code[i].target++;
+        }
+        if (is_cjmp(code[i].opcode))
+        {
+            while (code[code[i].a].opcode == OP_NOOP)
+                code[i].a++;
+        }
+    }
+
+    // JMP to a CJMP => compare and branch
+    for (int i = 0; i < code.size(); i++)
+    {
+        if (code[i].opcode == OP_JMP && is_cjmp(code[code[i].target].opcode))
+        {
+            const Instruction& cjmp = code[code[i].target];
+            code[i].opcode = OP_JMP_CJMP_GREATER + (cjmp.opcode - OP_CJMP_GREATER);
+            code[i].a = cjmp.a;
+            code[i].b = cjmp.b;
+            code[i].c = cjmp.c;
+            code[i].target = cjmp.target;
+        }
+    }
+
+    // ASSIGN followed by compare and branch or by PRINT
+    for (int i = 0; i + 1 < code.size(); i++)
+    {
+        int next = code[i+1].opcode;
+        if (next >= OP_JMP_CJMP_GREATER && next <= OP_JMP_CJMP_NOTEQUAL)
+        {
+            if (code[i].opcode == OP_ASSIGN_PLUS)
+                code[i].opcode = OP_ASSIGN_PLUS_CJMP_GREATER + (next - OP_JMP_CJMP_GREATER);
+            else if (code[i].opcode == OP_ASSIGN_MINUS)
+                code[i].opcode = OP_ASSIGN_MINUS_CJMP_GREATER + (next - OP_JMP_CJMP_GREATER);
+        }
+        else if (next == OP_PRINT)
+        {
+            if (code[i].opcode >= OP_ASSIGN_NONE && code[i].opcode <= OP_ASSIGN_DIV)
+                code[i].opcode = OP_ASSIGN_NONE_PRINT + (code[i].opcode - OP_ASSIGN_NONE);
+        }
+    }
+}
@@ -0,0 +1,154 @@
+#ifndef __BYTECODE__H__
+#define __BYTECODE__H__
+
+#include <vector>
+
+#include "compiler.h"
+
+using namespace std;
+
+/*
+ * Flat form of the intermediate representation. The linked InstructionNode
+ * lists of main and of every Function are laid out in a single array and
+ * jump targets are stored as indices into that array.
+ */
+enum Opcode
+{
+    OP_NOOP,
+    OP_PRINT,
+    OP_ASSIGN_NONE,
+    OP_ASSIGN_PLUS,
+    OP_ASSIGN_MINUS,
+    OP_ASSIGN_MULT,
+    OP_ASSIGN_DIV,
+    OP_CJMP_GREATER,
+    OP_CJMP_LESS,
+    OP_CJMP_NOTEQUAL,
+    OP_JMP,
+    OP_CALL,
+    OP_CALL_MEMO,
+    OP_TAILCALL,
+    OP_RET,
+    OP_HALT,
+    OP_SWITCH_TABLE,
+    OP_SWITCH_SEARCH,
+
+    // Superinstructions, only produced by fuse_superinstructions()
+    OP_JMP_CJMP_GREATER,
+    OP_JMP_CJMP_LESS,
+    OP_JMP_CJMP_NOTEQUAL,
+    OP_ASSIGN_PLUS_CJMP_GREATER,
+    OP_ASSIGN_PLUS_CJMP_LESS,
+    OP_ASSIGN_PLUS_CJMP_NOTEQUAL,
+    OP_ASSIGN_MINUS_CJMP_GREATER,
+    OP_ASSIGN_MINUS_CJMP_LESS,
+    OP_ASSIGN_MINUS_CJMP_NOTEQUAL,
+    OP_ASSIGN_NONE_PRINT,
+    OP_ASSIGN_PLUS_PRINT,
+    OP_ASSIGN_MINUS_PRINT,
+    OP_ASSIGN_MULT_PRINT,
+    OP_ASSIGN_DIV_PRINT,
+    OPCODE_COUNT
+};
+
+/*
+ * Fixed width instruction. The meaning of the fields depends on opcode:
+ *
+ *   OP_PRINT     a = var index
+ *   OP_ASSIGN_*  a = left hand side, b = operand1, c = operand2
+ *   OP_CJMP_*    b = operand1, c = operand2, a = index to continue at when
+ *                the condition holds, target = index otherwise (a is the next
+ *                instruction unless a profile said target is the likelier one)
+ *   OP_JMP       target = jump index
+ *   OP_CALL      target = function id, a = slot that receives the return value,
+ *                b = first argument in BytecodeProgram::arguments, c = argument
+ *                count, d = offset of the callee frame from the current one
+ *   OP_CALL_MEMO same as OP_CALL, to a function with a result cache
+ *   OP_TAILCALL  target, b and c as for OP_CALL, d = size of the current frame;
+ *                the callee frame replaces the current one
+ *   OP_SWITCH_TABLE   a = operand, b = first entry in BytecodeProgram::case_targets,
+ *                     c = value of that entry, d = entry count; the value
+ *                     c + i jumps to entry i
+ *   OP_SWITCH_SEARCH  a = operand, b = first entry in case_values and
+ *                     case_targets, d = entry count, values sorted
+ *                (both fall through to target, the next instruction, when no
+ *                case matches)
+ *
+ *   OP_JMP_CJMP_*         a jump to a CJMP with the comparison done in place:
+ *                         b = operand1, c = operand2, a = index to continue at
+ *                         when the condition holds, target = index otherwise
+ *   OP_ASSIGN_*_CJMP_*    an ASSIGN whose next instruction is an OP_JMP_CJMP_*
+ *   OP_ASSIGN_*_PRINT     an ASSIGN whose next instruction is an OP_PRINT
+ *
+ * A fused instruction reads the second half from the instruction after it,
+ * which is left in place so that it can still be jumped to on its own.
+ *
+ * handler is only used by the threaded interpreter, which stores the address
+ * of the code implementing opcode in it before running the program.
+ */
+struct Instruction
+{
+    const void* handler;
+    int opcode;
+    int a;
+    int b;
+    int c;
+    int d;
+    int target;
+};
+
+/*
+ * A callee frame is placed right after the frame of its caller and the
+ * FRAME_HEADER slots below it hold the saved frame_pointer and the index to
+ * return to. A new frame is a copy of frame_template (the localMem of the
+ * function) with the arguments written over slots 1 and up.
+ */
+#define FRAME_HEADER 2
+
+struct BytecodeFunction
+{
+    struct Function* function;
+    const int* frame_template;
+    int frame_size;
+    int entry;
+    struct MemoCache* cache;            // only for pure functions when memoizing
+};
+
+struct BytecodeProgram
+{
+    vector<Instruction> code;
+    vector<BytecodeFunction> functions;
+    vector<int> arguments;
+    vector<int> case_values;            // parallel to case_targets
+    vector<int> case_targets;
+    int entry;
+    const int* frame_template;          // frame of main
+    int frame_size;
+    vector<struct InstructionNode*> nodes;  // node each instruction comes from, NULL for
+                                            // the jumps and ends lowering adds
+};
+
+/*
+ * What execute_program counts when asked to: how often each instruction
+ * ran, how often each CJMP jumped to its target, and how often a SWITCH
+ * went to each of case_targets.
+ */
+struct ExecutionCounts
+{
+    vector<long long> executed;         // parallel to code
+    vector<long long> taken;            // parallel to code
+    vector<long long> cases;            // parallel to case_targets
+};
+
+struct BytecodeProgram* lower_program(struct InstructionNode* program);
+
+void fuse_superinstructions(struct BytecodeProgram* program);
+
+Opcode assign_opcode(ArithmeticOperatorType op);
+Opcode cjmp_opcode(ConditionalOperatorType condition_op);
+
+// Switch interpreter, counting into counts unless it is NULL
+void execute_program(struct BytecodeProgram* program, struct ExecutionCounts* counts);
+void execute_program_threaded(struct BytecodeProgram* program);
+
+#endif  //__BYTECODE__H__
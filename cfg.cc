@@ -0,0 +1,337 @@
+#include <set>
+#include <vector>
+
+#include "cfg.h"
+
+using namespace std;
+
+void node_successors(struct InstructionNode* node, vector<struct InstructionNode*>& successors)
+{
+    switch (node->type)
+    {
+        case CJMP:
+            successors.push_back(node->next);
+            successors.push_back(node->cjmp_inst.target);
+            break;
+        case JMP:
+            successors.push_back(node->jmp_inst.target);
+            break;
+        case SWITCHJMP:
+            successors.push_back(node->next);
+            for (int i = 0; i < node->switch_inst.cases->size(); i++)
+                successors.push_back(node->switch_inst.cases->at(i).target);
+            break;
+        case TAILCALL:
+            successors.push_back(NULL);
+            break;
+        default:
+            successors.push_back(node->next);
+            break;
+    }
+}
+
+void build_cfg(struct InstructionNode* body, ControlFlowGraph& cfg)
+{
+    cfg.blocks.clear();
+    cfg.block_of.clear();
+
+    // Reachable nodes in depth first order, with how many edges enter each
+    vector<InstructionNode*> order;
+    map<InstructionNode*, int> incoming;
+    set<InstructionNode*> leaders;
+    vector<InstructionNode*> work;
+    if (body != NULL)
+    {
+        work.push_back(body);
+        incoming[body] = 1;             // entering the body
+        leaders.insert(body);
+    }
+    set<InstructionNode*> seen;
+    while (!work.empty())
+    {
+        struct InstructionNode* node = work.back();
+        work.pop_back();
+        if (!seen.insert(node).second)
+            continue;
+        order.push_back(node);
+
+        vector<InstructionNode*> successors;
+        node_successors(node, successors);
+        for (int i = 0; i < successors.size(); i++)
+        {
+            if (successors[i] == NULL)
+                continue;
+            incoming[successors[i]]++;
+            if (node->type == CJMP || node->type == JMP || node->type == SWITCHJMP)
+                leaders.insert(successors[i]);
+            work.push_back(successors[i]);
+        }
+    }
+    for (int i = 0; i < order.size(); i++)
+    {
+        if (incoming[order[i]] > 1)
+            leaders.insert(order[i]);
+    }
+
+    // The entry block goes first, the others in the order they were reached
+    vector<InstructionNode*> heads;
+    heads.push_back(body);
+    for (int i = 0; i < order.size(); i++)
+    {
+        if (order[i] != body && leaders.count(order[i]))
+            heads.push_back(order[i]);
+    }
+    if (body == NULL)
+        heads.clear();
+    for (int i = 0; i < heads.size(); i++)
+        cfg.block_of[heads[i]] = i;
+    cfg.blocks.resize(heads.size());
+
+    for (int b = 0; b < heads.size(); b++)
+    {
+        BasicBlock& block = cfg.blocks[b];
+        struct InstructionNode* node = heads[b];
+        while (true)
+        {
+            block.nodes.push_back(node);
+            vector<InstructionNode*> successors;
+            node_successors(node, successors);
+            if (successors.size() == 1 && successors[0] != NULL && !leaders.count(successors[0]))
+            {
+                node = successors[0];
+                continue;
+            }
+            for (int i = 0; i < successors.size(); i++)
+            {
+                int target = successors[i] == NULL ? EXIT_BLOCK : cfg.block_of[successors[i]];
+                block.successors.push_back(target);
+            }
+            break;
+        }
+    }
+
+    for (int b = 0; b < cfg.blocks.size(); b++)
+    {
+        for (int i = 0; i < cfg.blocks[b].successors.size(); i++)
+        {
+            int s = cfg.blocks[b].successors[i];
+            if (s != EXIT_BLOCK)
+                cfg.blocks[s].predecessors.push_back(b);
+        }
+    }
+}
+
+void node_operands(struct InstructionNode* node, vector<int*>& operands)
+{
+    switch (node->type)
+    {
+        case ASSIGN:
+            operands.push_back(&node->assign_inst.operand1_index);
+            if (node->assign_inst.op != OPERATOR_NONE)
+                operands.push_back(&node->assign_inst.operand2_index);
+            break;
+        case PRINTIN:
+            operands.push_back(&node->print_inst.var_index);
+            break;
+        case CJMP:
+            operands.push_back(&node->cjmp_inst.operand1_index);
+            operands.push_back(&node->cjmp_inst.operand2_index);
+            break;
+        case SWITCHJMP:
+            operands.push_back(&node->switch_inst.operand_index);
+            break;
+        case FUNCTION:
+        case TAILCALL:
+            for (int i = 0; i < node->function_inst.operators->size(); i++)
+                operands.push_back(&node->function_inst.operators->at(i));
+            break;
+        default:
+            break;
+    }
+}
+
+void node_uses(struct InstructionNode* node, vector<int>& uses)
+{
+    vector<int*> operands;
+    node_operands(node, operands);
+    for (int i = 0; i < operands.size(); i++)
+        uses.push_back(*operands[i]);
+}
+
+int node_def(struct InstructionNode* node)
+{
+    if (node->type == ASSIGN)
+        return node->assign_inst.left_hand_side_index;
+    if (node->type == FUNCTION)
+        return node->function_inst.result_index;
+    return -1;
+}
+
+static void postorder(const ControlFlowGraph& cfg, int b, vector<bool>& visited, vector<int>& order)
+{
+    // Iterative, bodies can have very many blocks
+    vector<pair<int, int> > stack;
+    visited[b] = true;
+    stack.push_back(make_pair(b, 0));
+    while (!stack.empty())
+    {
+        int block = stack.back().first;
+        int& next = stack.back().second;
+        const vector<int>& successors = cfg.blocks[block].successors;
+        if (next < successors.size())
+        {
+            int s = successors[next++];
+            if (s != EXIT_BLOCK && !visited[s])
+            {
+                visited[s] = true;
+                stack.push_back(make_pair(s, 0));
+            }
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+}
+
+/*
+ * Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm": idoms
+ * are refined in reverse postorder until they stop changing.
+ */
+void compute_dominators(const ControlFlowGraph& cfg, vector<int>& idom)
+{
+    int count = cfg.blocks.size();
+    idom.assign(count, -1);
+    if (count == 0)
+        return;
+
+    vector<bool> visited(count, false);
+    vector<int> order;
+    postorder(cfg, 0, visited, order);
+    vector<int> number(count, -1);
+    for (int i = 0; i < order.size(); i++)
+        number[order[i]] = i;
+
+    idom[0] = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = order.size() - 1; i >= 0; i--)
+        {
+            int b = order[i];
+            if (b == 0)
+                continue;
+            int dominator = -1;
+            for (int p = 0; p < cfg.blocks[b].predecessors.size(); p++)
+            {
+                int other = cfg.blocks[b].predecessors[p];
+                if (idom[other] == -1)
+                    continue;
+                if (dominator == -1)
+                {
+                    dominator = other;
+                    continue;
+                }
+                while (dominator != other)
+                {
+                    while (number[dominator] < number[other])
+                        dominator = idom[dominator];
+                    while (number[other] < number[dominator])
+                        other = idom[other];
+                }
+            }
+            if (idom[b] != dominator)
+            {
+                idom[b] = dominator;
+                changed = true;
+            }
+        }
+    }
+    idom[0] = -1;
+}
+
+bool dominates(const vector<int>& idom, int a, int b)
+{
+    while (b != -1 && b != a)
+        b = idom[b];
+    return b == a;
+}
+
+void compute_liveness(const ControlFlowGraph& cfg, const vector<bool>& live_at_exit,
+                      vector<vector<bool> >& live_in)
+{
+    int count = cfg.blocks.size();
+    live_in.assign(count, vector<bool>(live_at_exit.size(), false));
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int b = count - 1; b >= 0; b--)
+        {
+            const BasicBlock& block = cfg.blocks[b];
+            vector<bool> live(live_at_exit.size(), false);
+            for (int i = 0; i < block.successors.size(); i++)
+            {
+                const vector<bool>& in = block.successors[i] == EXIT_BLOCK ? live_at_exit : live_in[block.successors[i]];
+                for (int slot = 0; slot < live.size(); slot++)
+                    live[slot] = live[slot] || in[slot];
+            }
+            for (int i = block.nodes.size() - 1; i >= 0; i--)
+            {
+                int def = node_def(block.nodes[i]);
+                if (def != -1)
+                    live[def] = false;
+                vector<int> uses;
+                node_uses(block.nodes[i], uses);
+                for (int u = 0; u < uses.size(); u++)
+                    live[uses[u]] = true;
+            }
+            if (live != live_in[b])
+            {
+                live_in[b] = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+void find_loops(const ControlFlowGraph& cfg, const vector<int>& idom, vector<Loop>& loops)
+{
+    map<int, int> loop_of;          // header -> index in loops
+    for (int b = 0; b < cfg.blocks.size(); b++)
+    {
+        for (int i = 0; i < cfg.blocks[b].successors.size(); i++)
+        {
+            int header = cfg.blocks[b].successors[i];
+            if (header == EXIT_BLOCK || !dominates(idom, header, b))
+                continue;
+
+            if (loop_of.find(header) == loop_of.end())
+            {
+                Loop loop;
+                loop.header = header;
+                loop.blocks.assign(cfg.blocks.size(), false);
+                loop.blocks[header] = true;
+                loop.size = 1;
+                loop_of[header] = loops.size();
+                loops.push_back(loop);
+            }
+            Loop& loop = loops[loop_of[header]];
+
+            vector<int> work;
+            work.push_back(b);
+            while (!work.empty())
+            {
+                int block = work.back();
+                work.pop_back();
+                if (loop.blocks[block])
+                    continue;
+                loop.blocks[block] = true;
+                loop.size++;
+                for (int p = 0; p < cfg.blocks[block].predecessors.size(); p++)
+                    work.push_back(cfg.blocks[block].predecessors[p]);
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef __CFG__H__
+#define __CFG__H__
+
+#include <map>
+#include <vector>
+
+#include "compiler.h"
+
+using namespace std;
+
+/*
+ * Basic blocks of a body. Only real control flow counts as an edge: the next
+ * of a JMP just says where the parser put the following statement, and
+ * nothing follows a TAILCALL.
+ *
+ * A block ending in a CJMP has the block run when the condition holds as its
+ * first successor and the target as its second, one ending in a SWITCHJMP
+ * has the block run when no case matches first and then one per case, in
+ * order. EXIT_BLOCK stands for leaving the body. Block 0 starts the body.
+ */
+#define EXIT_BLOCK -1
+
+struct BasicBlock
+{
+    vector<struct InstructionNode*> nodes;
+    vector<int> successors;
+    vector<int> predecessors;
+};
+
+struct ControlFlowGraph
+{
+    vector<BasicBlock> blocks;
+    map<struct InstructionNode*, int> block_of;         // first node of each block
+};
+
+void build_cfg(struct InstructionNode* body, ControlFlowGraph& cfg);
+
+// Nodes that can run after node, NULL for leaving the body
+void node_successors(struct InstructionNode* node, vector<struct InstructionNode*>& successors);
+
+// Slots read by node
+void node_uses(struct InstructionNode* node, vector<int>& uses);
+
+// The fields of node that hold the slots it reads, in the same order
+void node_operands(struct InstructionNode* node, vector<int*>& operands);
+
+// Slot written by node, -1 when it writes none
+int node_def(struct InstructionNode* node);
+
+// idom[b] is the block that immediately dominates block b, -1 for block 0
+void compute_dominators(const ControlFlowGraph& cfg, vector<int>& idom);
+bool dominates(const vector<int>& idom, int a, int b);
+
+/*
+ * live_in[b][slot] is true when the value slot holds as block b starts can
+ * still be read. live_at_exit says which slots are read after the body.
+ */
+void compute_liveness(const ControlFlowGraph& cfg, const vector<bool>& live_at_exit,
+                      vector<vector<bool> >& live_in);
+
+// A natural loop: the blocks that can reach a back edge to header without
+// going through header, all loops with the same header merged
+struct Loop
+{
+    int header;
+    vector<bool> blocks;
+    int size;
+};
+
+void find_loops(const ControlFlowGraph& cfg, const vector<int>& idom, vector<Loop>& loops);
+
+#endif  //__CFG__H__
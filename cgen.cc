@@ -0,0 +1,404 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "compiler.h"
+#include "cgen.h"
+#include "optimizer.h"
+
+using namespace std;
+
+struct CStatement
+{
+    struct InstructionNode* node;       // node whose label goes in front, or NULL
+    string text;
+};
+
+struct CFunction
+{
+    struct Function* function;
+    int parameters;                     // largest argument count of any call
+};
+
+struct CGenerator
+{
+    vector<CFunction> functions;
+    map<Function*, int> function_ids;
+    map<InstructionNode*, int> labels;
+    vector<bool> read;                  // slots of the body being emitted that something reads
+};
+
+static string slot(int index)
+{
+    char buffer[32];
+    sprintf(buffer, "v%d", index);
+    return buffer;
+}
+
+static string label(CGenerator& gen, struct InstructionNode* node)
+{
+    map<InstructionNode*, int>::iterator it = gen.labels.find(node);
+    int id;
+    if (it == gen.labels.end())
+    {
+        id = gen.labels.size();
+        gen.labels[node] = id;
+    }
+    else id = it->second;
+
+    char buffer[32];
+    sprintf(buffer, "L%d", id);
+    return buffer;
+}
+
+static string function_name(struct Function* function)
+{
+    return "f_" + function->name;
+}
+
+static void collect_calls(CGenerator& gen, struct InstructionNode* body)
+{
+    vector<InstructionNode*> nodes;
+    collect_nodes(body, nodes);
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i]->type != FUNCTION && nodes[i]->type != TAILCALL)
+            continue;
+
+        struct Function* function = nodes[i]->function_inst.function;
+        int arguments = nodes[i]->function_inst.operators->size();
+        map<Function*, int>::iterator it = gen.function_ids.find(function);
+        if (it == gen.function_ids.end())
+        {
+            CFunction entry;
+            entry.function = function;
+            entry.parameters = arguments;
+            gen.function_ids[function] = gen.functions.size();
+            gen.functions.push_back(entry);
+        }
+        else if (gen.functions[it->second].parameters < arguments)
+            gen.functions[it->second].parameters = arguments;
+    }
+}
+
+/*
+ * Marks the slots the nodes of body read. Only those get declared and a
+ * write to any other slot is left out, so the C has no unused variables.
+ * An assignment that is left out doesn't read anything either, so its
+ * operands only count once its own slot does.
+ */
+static void collect_reads(CGenerator& gen, struct InstructionNode* body, int frame_size, int returned)
+{
+    gen.read.assign(frame_size, false);
+    if (returned != -1)
+        gen.read[returned] = true;
+    vector<InstructionNode*> nodes;
+    collect_nodes(body, nodes);
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        struct InstructionNode* node = nodes[i];
+        switch (node->type)
+        {
+            case PRINTIN:
+                gen.read[node->print_inst.var_index] = true;
+                break;
+            case CJMP:
+                if (node->cjmp_inst.operand1_index == node->cjmp_inst.operand2_index)
+                    break;
+                gen.read[node->cjmp_inst.operand1_index] = true;
+                gen.read[node->cjmp_inst.operand2_index] = true;
+                break;
+            case SWITCHJMP:
+                gen.read[node->switch_inst.operand_index] = true;
+                break;
+            case FUNCTION:
+            case TAILCALL:
+                for (int a = 0; a < node->function_inst.operators->size(); a++)
+                    gen.read[node->function_inst.operators->at(a)] = true;
+                break;
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            struct InstructionNode* node = nodes[i];
+            if (node->type != ASSIGN || !gen.read[node->assign_inst.left_hand_side_index])
+                continue;
+            int op1 = node->assign_inst.operand1_index;
+            int op2 = node->assign_inst.op != OPERATOR_NONE ? node->assign_inst.operand2_index : op1;
+            if (!gen.read[op1] || !gen.read[op2])
+                changed = true;
+            gen.read[op1] = gen.read[op2] = true;
+        }
+    }
+}
+
+static string number(int value)
+{
+    char buffer[32];
+    sprintf(buffer, "%d", value);
+    return buffer;
+}
+
+// Arguments of a call, with the missing ones taken from the frame template
+static vector<string> call_arguments(const CFunction& callee, struct InstructionNode* node)
+{
+    vector<int>* operators = node->function_inst.operators;
+    vector<string> arguments;
+    for (int i = 0; i < callee.parameters; i++)
+    {
+        if (i < operators->size())
+            arguments.push_back(slot(operators->at(i)));
+        else
+            arguments.push_back(number(callee.function->localMem[i+1]));
+    }
+    return arguments;
+}
+
+static string call_text(const CFunction& callee, const vector<string>& arguments)
+{
+    string text = function_name(callee.function) + "(";
+    for (int i = 0; i < arguments.size(); i++)
+    {
+        if (i > 0) text += ", ";
+        text += arguments[i];
+    }
+    return text + ")";
+}
+
+// A tail call to the function itself starts the body over with a fresh frame
+static string self_tail_call_text(CGenerator& gen, const CFunction& function,
+                                  const vector<string>& arguments, struct InstructionNode* body)
+{
+    const vector<int>& frame = function.function->localMem;
+    string text = "{ ";
+    for (int i = 0; i < arguments.size(); i++)
+        text += "int t" + number(i + 1) + " = " + arguments[i] + "; ";
+    for (int i = 0; i < frame.size(); i++)
+    {
+        if (i >= 1 && i <= arguments.size())
+            text += slot(i) + " = t" + number(i) + "; ";
+        else if (gen.read[i])
+            text += slot(i) + " = " + number(frame[i]) + "; ";
+    }
+    return text + "} goto " + label(gen, body) + ";";
+}
+
+static string assign_text(CGenerator& gen, struct InstructionNode* node)
+{
+    if (!gen.read[node->assign_inst.left_hand_side_index])
+        return ";";
+    string lhs = slot(node->assign_inst.left_hand_side_index);
+    string op1 = slot(node->assign_inst.operand1_index);
+    string op2 = slot(node->assign_inst.operand2_index);
+    switch (node->assign_inst.op)
+    {
+        case OPERATOR_NONE:  return lhs + " = " + op1 + ";";
+        case OPERATOR_PLUS:  return lhs + " = ADD(" + op1 + ", " + op2 + ");";
+        case OPERATOR_MINUS: return lhs + " = SUB(" + op1 + ", " + op2 + ");";
+        case OPERATOR_MULT:  return lhs + " = MUL(" + op1 + ", " + op2 + ");";
+        case OPERATOR_DIV:   return lhs + " = " + op1 + " / " + op2 + ";";
+    }
+    debug("Error: invalid value for assign_inst.op (%d).\n", node->assign_inst.op);
+    exit(EXIT_FAILURE);
+}
+
+static string cjmp_text(CGenerator& gen, struct InstructionNode* node)
+{
+    // None of the conditions holds for a slot compared with itself, and C
+    // compilers warn about writing it out
+    if (node->cjmp_inst.operand1_index == node->cjmp_inst.operand2_index)
+        return "goto " + label(gen, node->cjmp_inst.target) + ";";
+
+    // CJMP falls through when the condition holds, so the goto is taken
+    // when it doesn't
+    string relop;
+    switch (node->cjmp_inst.condition_op)
+    {
+        case CONDITION_GREATER:  relop = " <= "; break;
+        case CONDITION_LESS:     relop = " >= "; break;
+        case CONDITION_NOTEQUAL: relop = " == "; break;
+        default:
+            debug("Error: invalid value for cjmp_inst.condition_op (%d).\n", node->cjmp_inst.condition_op);
+            exit(EXIT_FAILURE);
+    }
+    return "if (" + slot(node->cjmp_inst.operand1_index) + relop + slot(node->cjmp_inst.operand2_index) +
+           ") goto " + label(gen, node->cjmp_inst.target) + ";";
+}
+
+/*
+ * Lays the statements of a body out the same way lower_program does: chains
+ * are followed through next and the jump targets that aren't reached that
+ * way come after them.
+ */
+static void emit_body(CGenerator& gen, struct InstructionNode* body, const CFunction* current,
+                      const string& end, vector<CStatement>& statements)
+{
+    set<InstructionNode*> placed;
+    vector<InstructionNode*> pending;
+    pending.push_back(body);
+
+    while (!pending.empty())
+    {
+        struct InstructionNode* node = pending.back();
+        pending.pop_back();
+        if (placed.count(node))
+            continue;
+
+        while (node != NULL)
+        {
+            CStatement statement;
+            statement.node = NULL;
+            if (placed.count(node))
+            {
+                statement.text = "goto " + label(gen, node) + ";";
+                statements.push_back(statement);
+                break;
+            }
+            placed.insert(node);
+            statement.node = node;
+
+            switch (node->type)
+            {
+                case NOOP:
+                    statement.text = ";";
+                    break;
+                case PRINTIN:
+                    statement.text = "printf(\"%d \", " + slot(node->print_inst.var_index) + ");";
+                    break;
+                case ASSIGN:
+                    statement.text = assign_text(gen, node);
+                    break;
+                case CJMP:
+                    statement.text = cjmp_text(gen, node);
+                    pending.push_back(node->cjmp_inst.target);
+                    break;
+                case JMP:
+                    statement.text = "goto " + label(gen, node->jmp_inst.target) + ";";
+                    pending.push_back(node->jmp_inst.target);
+                    break;
+                case SWITCHJMP:
+                    statement.text = "switch (" + slot(node->switch_inst.operand_index) + ") {";
+                    for (int i = 0; i < node->switch_inst.cases->size(); i++)
+                    {
+                        const SwitchCase& c = node->switch_inst.cases->at(i);
+                        statement.text += " case " + number(c.value) + ": goto " + label(gen, c.target) + ";";
+                        pending.push_back(c.target);
+                    }
+                    statement.text += " }";
+                    break;
+                case FUNCTION:
+                case TAILCALL:
+                {
+                    const CFunction& callee = gen.functions[gen.function_ids[node->function_inst.function]];
+                    vector<string> arguments = call_arguments(callee, node);
+                    if (node->type == FUNCTION && !gen.read[node->function_inst.result_index])
+                        statement.text = call_text(callee, arguments) + ";";
+                    else if (node->type == FUNCTION)
+                        statement.text = slot(node->function_inst.result_index) + " = " + call_text(callee, arguments) + ";";
+                    else if (current != NULL && current->function == callee.function)
+                        statement.text = self_tail_call_text(gen, callee, arguments, body);
+                    else
+                        statement.text = "return " + call_text(callee, arguments) + ";";
+                    break;
+                }
+                default:
+                    debug("Error: invalid value for node->type (%d).\n", node->type);
+                    exit(EXIT_FAILURE);
+            }
+            statements.push_back(statement);
+            node = node->next;
+        }
+
+        if (node == NULL)
+        {
+            CStatement statement;
+            statement.node = NULL;
+            statement.text = end;
+            statements.push_back(statement);
+        }
+    }
+}
+
+static void write_frame(CGenerator& gen, FILE* out, const vector<int>& values, int first, int frame_size)
+{
+    for (int i = first; i < frame_size; i++)
+    {
+        if (gen.read[i])
+            fprintf(out, "    int %s = %d;\n", slot(i).c_str(), values[i]);
+    }
+}
+
+static void write_statements(CGenerator& gen, FILE* out, const vector<CStatement>& statements)
+{
+    for (int i = 0; i < statements.size(); i++)
+    {
+        if (statements[i].node != NULL && gen.labels.count(statements[i].node))
+            fprintf(out, "%s:\n", label(gen, statements[i].node).c_str());
+        fprintf(out, "    %s\n", statements[i].text.c_str());
+    }
+}
+
+static void write_signature(FILE* out, const CFunction& function)
+{
+    fprintf(out, "static int %s(", function_name(function.function).c_str());
+    for (int i = 0; i < function.parameters; i++)
+        fprintf(out, "%sint %s", i > 0 ? ", " : "", slot(i + 1).c_str());
+    if (function.parameters == 0)
+        fprintf(out, "void");
+    fprintf(out, ")");
+}
+
+void emit_c_program(struct InstructionNode* program, FILE* out)
+{
+    CGenerator gen;
+    collect_calls(gen, program);
+    for (int i = 0; i < gen.functions.size(); i++)
+        collect_calls(gen, gen.functions[i].function->body);
+
+    fprintf(out, "#include <stdio.h>\n\n");
+    fprintf(out, "/* Arithmetic wraps around like it does in the interpreter */\n");
+    fprintf(out, "#define ADD(a, b) ((int) ((unsigned) (a) + (unsigned) (b)))\n");
+    fprintf(out, "#define SUB(a, b) ((int) ((unsigned) (a) - (unsigned) (b)))\n");
+    fprintf(out, "#define MUL(a, b) ((int) ((unsigned) (a) * (unsigned) (b)))\n\n");
+
+    for (int i = 0; i < gen.functions.size(); i++)
+    {
+        write_signature(out, gen.functions[i]);
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "\n");
+
+    for (int i = 0; i < gen.functions.size(); i++)
+    {
+        struct Function* function = gen.functions[i].function;
+        vector<CStatement> statements;
+        gen.labels.clear();
+        collect_reads(gen, function->body, function->localMem.size(), 0);
+        emit_body(gen, function->body, &gen.functions[i], "return v0;", statements);
+
+        write_signature(out, gen.functions[i]);
+        fprintf(out, "\n{\n");
+        fprintf(out, "    int v0 = %d;\n", function->localMem[0]);
+        write_frame(gen, out, function->localMem, gen.functions[i].parameters + 1, function->localMem.size());
+        write_statements(gen, out, statements);
+        fprintf(out, "}\n\n");
+    }
+
+    vector<CStatement> statements;
+    gen.labels.clear();
+    collect_reads(gen, program, main_function->localMem.size(), -1);
+    emit_body(gen, program, NULL, "return 0;", statements);
+
+    fprintf(out, "int main(void)\n{\n");
+    write_frame(gen, out, main_function->localMem, 0, main_function->localMem.size());
+    write_statements(gen, out, statements);
+    fprintf(out, "}\n");
+}
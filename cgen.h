@@ -0,0 +1,16 @@
+#ifndef __CGEN__H__
+#define __CGEN__H__
+
+#include <cstdio>
+
+#include "compiler.h"
+
+/*
+ * Ahead-of-time backend. Writes a standalone C translation unit for the
+ * program to out: every Function becomes a C function whose frame slots are
+ * local variables, and CJMP/JMP become gotos to labels. The result can be
+ * built with any C compiler, e.g. cc -O2.
+ */
+void emit_c_program(struct InstructionNode* program, FILE* out);
+
+#endif  //__CGEN__H__
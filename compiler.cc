@@ -11,17 +11,20 @@
 #include <string>
 
 #include "compiler.h"
+#include "bytecode.h"
+#include "runtime.h"
+#include "jit.h"
+#include "cgen.h"
+#include "optimizer.h"
+#include "memo.h"
+#include "profile.h"
 
 using namespace std;
 
 #define DEBUG 1     // 1 => Turn ON debugging, 0 => Turn OFF debugging
 
-string varNames[1000];
-int mem[1000];
-
 int stack_pointer = 0;
 int frame_pointer = 0;
-vector<InstructionNode*> return_addresses;
 
 std::vector<int> inputs;
 int next_input = 0;
@@ -37,138 +40,208 @@ void debug(const char* format, ...)
     }
 }
 
-void execute_program(struct InstructionNode * program)
+// Counts a jump from pc to target and returns target
+static inline int taken(struct ExecutionCounts * counts, int pc, int target)
+{
+    if (counts != NULL)
+        counts->taken[pc]++;
+    return target;
+}
+
+void execute_program(struct BytecodeProgram * program, struct ExecutionCounts * counts)
 {
-    struct InstructionNode * pc = program;
-    int op1, op2, result, i;
-    struct Function* func;
-    do
+    const Instruction * code = &program->code[0];
+    int pc = program->entry;
+    if (counts != NULL)
+    {
+        counts->executed.assign(program->code.size(), 0);
+        counts->taken.assign(program->code.size(), 0);
+        counts->cases.assign(program->case_targets.size(), 0);
+    }
+    while (true)
     {
-        switch(pc->type)
+        const Instruction * inst = &code[pc];
+        if (counts != NULL)
+            counts->executed[pc]++;
+        switch(inst->opcode)
         {
-            case FUNCTION:
-                func = pc->function_inst.function;
-                for (i = 0; i < pc->function_inst.operators->size(); i++)
-                {
-                    func->localMem[i+1] = mem[frame_pointer + pc->function_inst.operators->at(i)];
-                }
-                mem[stack_pointer + frame_pointer] = frame_pointer;
-                return_addresses.push_back(pc->next);
-                frame_pointer += stack_pointer+1;
-                stack_pointer = 0;
-                for (int i = 0; i < func->localMem.size(); i++)
-                {
-                    varNames[frame_pointer + stack_pointer] = func->localvarNames[i];
-                    mem[frame_pointer + stack_pointer] = func->localMem[i];
-                    stack_pointer++;
-                }
-                pc = func->body;
+            case OP_CALL:
+                pc = call_function(program, inst, pc + 1);
                 break;
-            case NOOP:
-                pc = pc->next;
+            case OP_CALL_MEMO:
+                pc = call_function_memo(program, inst, pc + 1);
                 break;
-            case PRINTIN:
-                printf("%d ", mem[frame_pointer + pc->print_inst.var_index]);
-                pc = pc->next;
+            case OP_TAILCALL:
+                pc = tail_call_function(program, inst);
                 break;
-            case ASSIGN:
-                switch(pc->assign_inst.op)
-                {
-                    case OPERATOR_PLUS:
-                        op1 = mem[frame_pointer + pc->assign_inst.operand1_index];
-                        op2 = mem[frame_pointer + pc->assign_inst.operand2_index];
-                        result = op1 + op2;
-                        break;
-                    case OPERATOR_MINUS:
-                        op1 = mem[frame_pointer + pc->assign_inst.operand1_index];
-                        op2 = mem[frame_pointer + pc->assign_inst.operand2_index];
-                        result = op1 - op2;
-                        break;
-                    case OPERATOR_MULT:
-                        op1 = mem[frame_pointer + pc->assign_inst.operand1_index];
-                        op2 = mem[frame_pointer + pc->assign_inst.operand2_index];
-                        result = op1 * op2;
-                        break;
-                    case OPERATOR_DIV:
-                        op1 = mem[frame_pointer + pc->assign_inst.operand1_index];
-                        op2 = mem[frame_pointer + pc->assign_inst.operand2_index];
-                        result = op1 / op2;
-                        break;
-                    case OPERATOR_NONE:
-                        op1 = mem[frame_pointer + pc->assign_inst.operand1_index];
-                        result = op1;
-                        break;
-                }
-                mem[frame_pointer + pc->assign_inst.left_hand_side_index] = result;
-                pc = pc->next;
+            case OP_NOOP:
+                pc++;
                 break;
-            case CJMP:
-                if (pc->cjmp_inst.target == NULL)
-                {
-                    debug("Error: pc->cjmp_inst->target is null.\n");
-                    exit(EXIT_FAILURE);
-                }
-                op1 = mem[frame_pointer + pc->cjmp_inst.operand1_index];
-                op2 = mem[frame_pointer + pc->cjmp_inst.operand2_index];
-                switch(pc->cjmp_inst.condition_op)
-                {
-                    case CONDITION_GREATER:
-                        if(op1 > op2)
-                            pc = pc->next;
-                        else
-                            pc = pc->cjmp_inst.target;
-                        break;
-                    case CONDITION_LESS:
-                        if(op1 < op2)
-                            pc = pc->next;
-                        else
-                            pc = pc->cjmp_inst.target;
-                        break;
-                    case CONDITION_NOTEQUAL:
-                        if(op1 != op2)
-                            pc = pc->next;
-                        else
-                            pc = pc->cjmp_inst.target;
-                        break;
-                }
+            case OP_PRINT:
+                printf("%d ", mem[frame_pointer + inst->a]);
+                pc++;
+                break;
+            case OP_ASSIGN_NONE:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b];
+                pc++;
+                break;
+            case OP_ASSIGN_PLUS:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] + mem[frame_pointer + inst->c];
+                pc++;
+                break;
+            case OP_ASSIGN_MINUS:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] - mem[frame_pointer + inst->c];
+                pc++;
+                break;
+            case OP_ASSIGN_MULT:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] * mem[frame_pointer + inst->c];
+                pc++;
+                break;
+            case OP_ASSIGN_DIV:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] / mem[frame_pointer + inst->c];
+                pc++;
+                break;
+            case OP_CJMP_GREATER:
+                if (mem[frame_pointer + inst->b] > mem[frame_pointer + inst->c])
+                    pc = inst->a;
+                else
+                    pc = taken(counts, pc, inst->target);
                 break;
-            case JMP:
-                if (pc->jmp_inst.target == NULL)
+            case OP_CJMP_LESS:
+                if (mem[frame_pointer + inst->b] < mem[frame_pointer + inst->c])
+                    pc = inst->a;
+                else
+                    pc = taken(counts, pc, inst->target);
+                break;
+            case OP_CJMP_NOTEQUAL:
+                if (mem[frame_pointer + inst->b] != mem[frame_pointer + inst->c])
+                    pc = inst->a;
+                else
+                    pc = taken(counts, pc, inst->target);
+                break;
+            case OP_JMP:
+                pc = inst->target;
+                break;
+            case OP_SWITCH_TABLE:
+            case OP_SWITCH_SEARCH:
+                if (counts != NULL)
                 {
-                    debug("Error: pc->jmp_inst->target is null.\n");
-                    exit(EXIT_FAILURE);
+                    int entry = switch_entry(program, inst, mem[frame_pointer + inst->a]);
+                    if (entry != -1)
+                        counts->cases[entry]++;
                 }
-                pc = pc->jmp_inst.target;
+                pc = switch_target(program, inst, mem[frame_pointer + inst->a]);
                 break;
+            case OP_RET: // Return from function
+                pc = return_from_function(program);
+                break;
+            case OP_HALT:
+                return;
             default:
-                debug("Error: invalid value for pc->type (%d).\n", pc->type);
+                debug("Error: invalid value for inst->opcode (%d).\n", inst->opcode);
                 exit(EXIT_FAILURE);
                 break;
         }
+    }
+}
 
-        if (pc == NULL && !return_addresses.empty()) // Return from function
+enum ExecutionEngine
+{
+    ENGINE_SWITCH,
+    ENGINE_THREADED,
+    ENGINE_JIT,
+    ENGINE_TRACE,       // switch interpreter that compiles hot loops
+    ENGINE_EMIT_C       // write the program out as C instead of running it
+};
+
+int main(int argc, char* argv[])
+{
+    ExecutionEngine engine = ENGINE_THREADED;
+    bool optimize = true;
+    bool memo_statistics = false;
+    const char* profile_output = NULL;
+    const char* profile_input = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-switch") == 0)
+            engine = ENGINE_SWITCH;
+        else if (strcmp(argv[i], "-threaded") == 0)
+            engine = ENGINE_THREADED;
+        else if (strcmp(argv[i], "-jit") == 0)
+            engine = ENGINE_JIT;
+        else if (strcmp(argv[i], "-trace") == 0)
+            engine = ENGINE_TRACE;
+        else if (strcmp(argv[i], "-emit-c") == 0)
+            engine = ENGINE_EMIT_C;
+        else if (strcmp(argv[i], "-O0") == 0)
+            optimize = false;
+        else if (strncmp(argv[i], "-inline-budget=", 15) == 0)
+            inline_budget = atoi(argv[i] + 15);
+        else if (strcmp(argv[i], "-memo") == 0)
+            memoization = true;
+        else if (strcmp(argv[i], "-memo-stats") == 0)
+            memoization = memo_statistics = true;
+        else if (strncmp(argv[i], "-profile-generate=", 18) == 0)
+            profile_output = argv[i] + 18;
+        else if (strncmp(argv[i], "-profile-use=", 13) == 0)
+            profile_input = argv[i] + 13;
+        else
         {
-            int frame = mem[frame_pointer-1];
-            mem[frame_pointer-1] = mem[frame_pointer];
-            varNames[frame_pointer-1] = varNames[frame_pointer];
-            //debug("Function returned %d\n", mem[frame_pointer]);
-            for (int i = frame_pointer; i < stack_pointer; i++)
-            {
-                mem[frame_pointer + i] = 0;
-                varNames[frame_pointer + i].clear();
-            }
-            stack_pointer = frame_pointer - frame - 1;
-            frame_pointer = frame;
-            pc = return_addresses[return_addresses.size()-1];
-            return_addresses.pop_back();
+            debug("Usage: %s [-switch | -threaded | -jit | -trace | -emit-c] [-O0] [-inline-budget=N] [-memo | -memo-stats]\n"
+                  "       [-profile-generate=FILE | -profile-use=FILE] < program\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
-    } while(pc != NULL);
-}
+    }
 
-int main()
-{
-    struct InstructionNode * program;
-    program = parse_generate_intermediate_representation();
-    execute_program(program);
+    parse_generate_intermediate_representation();
+    if (profile_output != NULL || profile_input != NULL)
+        number_nodes();
+
+    // The training run counts the program as parsed, so the counts can be
+    // matched with the nodes of the next compile, and runs every call
+    if (profile_output != NULL)
+    {
+        memoization = false;
+        struct BytecodeProgram * code = lower_program(main_function->body);
+        struct ExecutionCounts counts;
+        enter_main(code);
+        execute_program(code, &counts);
+        write_profile(profile_output, code, counts);
+        return 0;
+    }
+
+    if (profile_input != NULL)
+        read_profile(profile_input);
+    if (optimize)
+        optimize_program();
+    if (memoization)
+        classify_pure_functions();
+    if (engine == ENGINE_EMIT_C)
+    {
+        emit_c_program(main_function->body, stdout);
+        return 0;
+    }
+
+    struct BytecodeProgram * code = lower_program(main_function->body);
+    enter_main(code);
+    switch (engine)
+    {
+        case ENGINE_JIT:
+            // Fall back to the switch interpreter
+            if (!execute_program_jit(code))
+                execute_program(code, NULL);
+            break;
+        case ENGINE_SWITCH:
+            execute_program(code, NULL);
+            break;
+        case ENGINE_TRACE:
+            execute_program_traced(code);
+            break;
+        default:            // ENGINE_THREADED; ENGINE_EMIT_C returned above
+            execute_program_threaded(code);
+            break;
+    }
+    if (memo_statistics)
+        print_memo_statistics(stderr);
     return 0;
 }
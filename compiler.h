@@ -7,13 +7,31 @@
 #define _COMPILER_H_
 
 #include <string.h>
+#include <map>
 #include <string>
 #include <vector>
 
 using namespace std;
 
-extern string varNames[1000];
-extern int mem[1000];
+/*
+ * The runtime stack lives in a reserved range of address space that is
+ * committed in chunks as it grows (see stack.cc), so it never moves and
+ * frames can be addressed relative to frame_pointer without a fixed limit.
+ * stack_limit is the number of slots that are currently committed.
+ */
+#define STACK_RESERVE   (1 << 28)   // slots of address space set aside for the stack
+
+extern int* mem;
+extern int stack_limit;
+
+void grow_stack(int top);
+
+// Makes sure slots [0, top) can be used
+inline void ensure_stack(int top)
+{
+    if (top > stack_limit)
+        grow_stack(top);
+}
 
 extern int stack_pointer;
 extern int frame_pointer;
@@ -42,7 +60,15 @@ enum InstructionType
     ASSIGN,
     CJMP,
     JMP,
-    FUNCTION
+    FUNCTION,
+    TAILCALL,       // FUNCTION in tail position, reuses the frame of the caller
+    SWITCHJMP       // jumps to the case matching a slot, goes on to next otherwise
+};
+
+struct SwitchCase
+{
+    int value;
+    struct InstructionNode* target;
 };
 
 struct Function
@@ -50,7 +76,10 @@ struct Function
     string name;
     vector<string> localvarNames;
     vector<int> localMem;
+    map<int, int> constant_slots;    // slot holding each literal, by value
     struct InstructionNode* body;
+    int parameter_count;        // parameters are slots 1 to parameter_count
+    bool pure;                  // no print, directly or through a call
 };
 
 struct InstructionNode
@@ -76,6 +105,7 @@ struct InstructionNode
         {
             struct Function* function;
             vector<int>* operators;
+            int result_index;       // slot the return value is copied to
         } function_inst;
         
         struct
@@ -93,6 +123,11 @@ struct InstructionNode
         struct {
             struct InstructionNode * target;
         } jmp_inst;
+
+        struct {
+            int operand_index;
+            vector<struct SwitchCase>* cases;   // values are all different
+        } switch_inst;
   
     };
 
@@ -103,4 +138,12 @@ void debug(const char* format, ...);
 
 struct InstructionNode * parse_generate_intermediate_representation();
 
+// Every function of the program, filled in by the call above
+extern vector<struct Function*> declared_functions;
+
+// Body and frame of main, also filled in by the call above. Passes that change
+// the program update it; the frame the parser leaves in mem is only its
+// starting point.
+extern struct Function* main_function;
+
 #endif /* _COMPILER_H_ */
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "compiler.h"
+#include "optimizer.h"
+#include "cfg.h"
+#include "profile.h"
+
+using namespace std;
+
+// Largest callee, in statements, that is copied into its callers
+#define INLINE_SIZE 16
+
+// Same for calls the profile says are hot
+#define HOT_INLINE_SIZE 64
+
+int inline_budget = 1000;
+
+// Statements of the body that do some work
+static int body_size(struct Function* function)
+{
+    vector<InstructionNode*> nodes;
+    collect_nodes(function->body, nodes);
+    int size = 0;
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i]->type != NOOP && nodes[i]->type != JMP)
+            size++;
+    }
+    return size;
+}
+
+static void callees(struct Function* function, vector<Function*>& functions)
+{
+    vector<InstructionNode*> nodes;
+    collect_nodes(function->body, nodes);
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i]->type == FUNCTION || nodes[i]->type == TAILCALL)
+            functions.push_back(nodes[i]->function_inst.function);
+    }
+}
+
+// Functions reachable from main through calls, every callee before its callers
+static void call_order(struct Function* function, set<Function*>& seen, vector<Function*>& order)
+{
+    seen.insert(function);
+    vector<Function*> functions;
+    callees(function, functions);
+    for (int i = 0; i < functions.size(); i++)
+    {
+        if (!seen.count(functions[i]))
+            call_order(functions[i], seen, order);
+    }
+    order.push_back(function);
+}
+
+static bool is_recursive(struct Function* function)
+{
+    set<Function*> seen;
+    vector<Function*> work;
+    callees(function, work);
+    while (!work.empty())
+    {
+        struct Function* callee = work.back();
+        work.pop_back();
+        if (callee == function)
+            return true;
+        if (seen.insert(callee).second)
+            callees(callee, work);
+    }
+    return false;
+}
+
+static struct InstructionNode* new_copy(int lhs, int operand)
+{
+    struct InstructionNode* node = new InstructionNode;
+    node->type = ASSIGN;
+    node->assign_inst.left_hand_side_index = lhs;
+    node->assign_inst.operand1_index = operand;
+    node->assign_inst.operand2_index = 0;
+    node->assign_inst.op = OPERATOR_NONE;
+    node->next = NULL;
+    return node;
+}
+
+/*
+ * Replaces call with a copy of the body of the callee. Every slot of the
+ * callee gets a slot of its own in the caller, except for the return value,
+ * which goes straight to the slot the call result was meant for, and the
+ * slots the callee never writes, which become the arguments or constants of
+ * the caller. The slots a fresh frame would have set are set in front of the
+ * copy when the copy reads them before writing them.
+ */
+static void inline_call(struct Function* caller, struct InstructionNode* call)
+{
+    struct Function* callee = call->function_inst.function;
+    int frame_size = callee->localMem.size();
+
+    vector<InstructionNode*> nodes;
+    collect_nodes(callee->body, nodes);
+    vector<bool> written(frame_size, false);
+    written[0] = true;
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        int def = node_def(nodes[i]);
+        if (def != -1)
+            written[def] = true;
+    }
+
+    ControlFlowGraph cfg;
+    build_cfg(callee->body, cfg);
+    vector<bool> live_at_exit(frame_size, false);
+    live_at_exit[0] = true;
+    vector<vector<bool> > live_in;
+    compute_liveness(cfg, live_at_exit, live_in);
+
+    // A parameter that is only read can read the argument itself
+    vector<int>* arguments = call->function_inst.operators;
+    vector<int> slots(frame_size);
+    vector<InstructionNode*> setup;
+    for (int i = 0; i < frame_size; i++)
+    {
+        bool argument = i >= 1 && i <= arguments->size();
+        if (i == 0)
+            slots[i] = call->function_inst.result_index;
+        else if (argument && !written[i])
+        {
+            slots[i] = arguments->at(i - 1);
+            continue;
+        }
+        else if (written[i])
+            slots[i] = temp_slot(caller);
+        else
+        {
+            slots[i] = constant_slot(caller, callee->localMem[i]);
+            continue;
+        }
+
+        if (!live_in[0][i])
+            continue;
+        if (argument)
+            setup.push_back(new_copy(slots[i], arguments->at(i - 1)));
+        else
+            setup.push_back(new_copy(slots[i], constant_slot(caller, callee->localMem[i])));
+    }
+
+    struct InstructionNode* after = call->next;
+    map<InstructionNode*, InstructionNode*> copies;
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        copies[nodes[i]] = new InstructionNode(*nodes[i]);
+        copy_profile(nodes[i], copies[nodes[i]]);
+    }
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        struct InstructionNode* copy = copies[nodes[i]];
+        switch (copy->type)
+        {
+            case ASSIGN:
+                copy->assign_inst.left_hand_side_index = slots[copy->assign_inst.left_hand_side_index];
+                copy->assign_inst.operand1_index = slots[copy->assign_inst.operand1_index];
+                if (copy->assign_inst.op != OPERATOR_NONE)
+                    copy->assign_inst.operand2_index = slots[copy->assign_inst.operand2_index];
+                break;
+            case PRINTIN:
+                copy->print_inst.var_index = slots[copy->print_inst.var_index];
+                break;
+            case CJMP:
+                copy->cjmp_inst.operand1_index = slots[copy->cjmp_inst.operand1_index];
+                copy->cjmp_inst.operand2_index = slots[copy->cjmp_inst.operand2_index];
+                copy->cjmp_inst.target = copies[copy->cjmp_inst.target];
+                break;
+            case JMP:
+                copy->jmp_inst.target = copies[copy->jmp_inst.target];
+                break;
+            case SWITCHJMP:
+                copy->switch_inst.operand_index = slots[copy->switch_inst.operand_index];
+                copy->switch_inst.cases = new vector<SwitchCase>(*copy->switch_inst.cases);
+                for (int c = 0; c < copy->switch_inst.cases->size(); c++)
+                    copy->switch_inst.cases->at(c).target = copies[copy->switch_inst.cases->at(c).target];
+                break;
+            case FUNCTION:
+                copy->function_inst.operators = new vector<int>(*copy->function_inst.operators);
+                for (int a = 0; a < copy->function_inst.operators->size(); a++)
+                    copy->function_inst.operators->at(a) = slots[copy->function_inst.operators->at(a)];
+                copy->function_inst.result_index = slots[copy->function_inst.result_index];
+                break;
+            default:
+                break;
+        }
+
+        // Falling off the end of the callee returns to the caller
+        if (copy->next != NULL)
+            copy->next = copies[copy->next];
+        else if (copy->type != JMP)
+            copy->next = after;
+    }
+
+    // The call node stays where it is, since other nodes point to it
+    setup.push_back(copies[callee->body]);
+    for (int i = 0; i + 1 < setup.size(); i++)
+        setup[i]->next = setup[i+1];
+    call->type = NOOP;
+    call->next = setup[0];
+}
+
+// Times the call ran in the training run, -1 without a profile
+static long long call_count(struct InstructionNode* call)
+{
+    const NodeProfile* profile = node_profile(call);
+    return profile == NULL ? -1 : profile->executed;
+}
+
+/*
+ * Copies small functions that don't end up calling themselves into their
+ * callers, as long as inline_budget (the number of statements the copies
+ * can add up to) lasts. Callees are handled before their callers, so a
+ * function is copied with its own calls already inlined.
+ *
+ * With a profile, calls that never ran are left alone, and calls that ran
+ * at least a hundredth as often as the most frequent one take callees up to
+ * HOT_INLINE_SIZE statements.
+ */
+void inline_functions()
+{
+    set<Function*> seen;
+    vector<Function*> order;
+    call_order(main_function, seen, order);
+
+    long long hottest = 0;
+    for (int f = 0; f < order.size(); f++)
+    {
+        vector<InstructionNode*> nodes;
+        collect_nodes(order[f]->body, nodes);
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i]->type == FUNCTION)
+                hottest = max(hottest, call_count(nodes[i]));
+        }
+    }
+
+    for (int f = 0; f < order.size(); f++)
+    {
+        vector<InstructionNode*> nodes;
+        collect_nodes(order[f]->body, nodes);
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i]->type != FUNCTION)
+                continue;
+            struct Function* callee = nodes[i]->function_inst.function;
+            int size = body_size(callee);
+            int limit = INLINE_SIZE;
+            long long count = call_count(nodes[i]);
+            if (count == 0)
+                continue;
+            if (count > 0 && 100 * count >= hottest)
+                limit = HOT_INLINE_SIZE;
+            if (callee == order[f] || size > limit || size > inline_budget || is_recursive(callee))
+                continue;
+            // Extra arguments land on the locals of the callee
+            if (nodes[i]->function_inst.operators->size() > callee->parameter_count)
+                continue;
+            inline_call(order[f], nodes[i]);
+            inline_budget -= size;
+        }
+    }
+}
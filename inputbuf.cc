@@ -3,44 +3,72 @@
  *
  * Do not share this file with anyone
  */
-#include <iostream>
-#include <istream>
-#include <vector>
-#include <string>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "inputbuf.h"
 
 using namespace std;
 
-bool InputBuffer::EndOfInput()
-{
-    if (!input_buffer.empty())
-        return false;
-    else
-        return cin.eof();
-}
+#define READ_SIZE (1 << 16)
 
-char InputBuffer::UngetChar(char c)
+InputBuffer::InputBuffer()
 {
-    if (c != EOF)
-        input_buffer.push_back(c);;
-    return c;
-}
+    struct stat status;
+    mapped = false;
+    if (fstat(STDIN_FILENO, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+    {
+        // Input starts wherever the file offset of stdin is
+        off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        void* file = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+        if (offset != -1 && offset <= status.st_size && file != MAP_FAILED)
+        {
+            madvise(file, status.st_size, MADV_SEQUENTIAL);
+            begin = (const char*) file;
+            cursor = begin + offset;
+            end = begin + status.st_size;
+            mapped = true;
+            return;
+        }
+        if (file != MAP_FAILED)
+            munmap(file, status.st_size);
+    }
 
-void InputBuffer::GetChar(char& c)
-{
-    if (!input_buffer.empty()) {
-        c = input_buffer.back();
-        input_buffer.pop_back();
-    } else {
-        cin.get(c);
+    // Pipes and terminals are read to the end, doubling the buffer as needed
+    size_t capacity = READ_SIZE;
+    size_t size = 0;
+    char* buffer = (char*) malloc(capacity);
+    while (true)
+    {
+        if (capacity - size < READ_SIZE)
+        {
+            capacity *= 2;
+            buffer = (char*) realloc(buffer, capacity);
+        }
+        if (buffer == NULL)
+        {
+            fprintf(stderr, "Error: out of memory reading the program\n");
+            exit(EXIT_FAILURE);
+        }
+        ssize_t count = read(STDIN_FILENO, buffer + size, capacity - size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        size += count;
     }
+    begin = cursor = buffer;
+    end = buffer + size;
 }
 
-string InputBuffer::UngetString(string s)
+InputBuffer::~InputBuffer()
 {
-    for (int i = 0; i < s.size(); i++)
-        input_buffer.push_back(s[s.size()-i-1]);
-    return s;
+    if (mapped)
+        munmap((void*) begin, end - begin);
+    else
+        free((void*) begin);
 }
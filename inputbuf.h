@@ -6,18 +6,64 @@
 #ifndef __INPUT_BUFFER__H__
 #define __INPUT_BUFFER__H__
 
+#include <cstdio>
 #include <string>
-#include <vector>
 
+/*
+ * The whole of standard input, mapped when it is a file and read in large
+ * blocks otherwise, scanned with a pointer. Like cin, it only reaches the end
+ * of input once a GetChar has tried to read past the last character, and
+ * ungetting is moving the pointer back over what was read.
+ */
 class InputBuffer {
   public:
-    void GetChar(char&);
-    char UngetChar(char);
-    std::string UngetString(std::string);
-    bool EndOfInput();
+    InputBuffer();
+    ~InputBuffer();
+
+    void GetChar(char& c)
+    {
+        if (cursor < end)
+            c = *cursor++;
+        else
+        {
+            c = EOF;
+            cursor = end + 1;
+        }
+    }
+
+    // c has to be the character GetChar returned last
+    char UngetChar(char c)
+    {
+        if (c != EOF)
+            cursor--;
+        return c;
+    }
+
+    // s has to be the characters read last
+    std::string UngetString(std::string s)
+    {
+        if (cursor > end)
+            cursor = end;
+        cursor -= s.size();
+        return s;
+    }
+
+    bool EndOfInput()
+    {
+        return cursor > end;
+    }
+
+    // For scanning with a pointer: the characters not read yet are
+    // [Position(), Limit()), and Seek moves past the ones used
+    const char* Position() const { return cursor; }
+    const char* Limit() const { return end; }
+    void Seek(const char* position) { cursor = position; }
 
   private:
-    std::vector<char> input_buffer;
+    const char* begin;
+    const char* cursor;
+    const char* end;
+    bool mapped;
 };
 
 #endif  //__INPUT_BUFFER__H__
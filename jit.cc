@@ -0,0 +1,725 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "compiler.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "memo.h"
+#include "regalloc.h"
+
+using namespace std;
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+
+#include <sys/mman.h>
+
+// Register numbers as used in the ModRM byte
+enum Register
+{
+    EAX = 0,
+    ECX = 1,
+    EDX = 2,
+    EBX = 3,
+    ESP = 4,
+    EBP = 5,
+    ESI = 6,
+    EDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15
+};
+
+// Callee saved, so they survive calls to the runtime and to other functions
+static const int allocatable[] = { EBX, R12, R13, R14, R15 };
+#define ALLOCATABLE_COUNT 5
+
+struct Assembler
+{
+    vector<unsigned char> code;
+    vector<pair<int, int> > jumps;      // rel32 position -> bytecode index
+    vector<pair<int, int> > calls;      // rel32 position -> function id
+    vector<pair<int, int> > tail_calls; // rel32 position -> function id
+    vector<pair<int, int> > case_entries; // jump table entry -> bytecode index
+    vector<int> registers;              // slot of the current frame -> register, -1 for none
+    vector<int> saved;                  // registers the current function pushed
+};
+
+// push rbp; mov rbp, rdi
+#define PROLOGUE_SIZE 4
+
+/*
+ * Return addresses and saved registers take at most 64 bytes of native
+ * stack per call, and every call that isn't a tail call moves the frame
+ * pointer up by at least FRAME_HEADER + 1 slots. Compiled code runs on a
+ * native stack big enough for the deepest recursion the runtime stack can
+ * hold, so running out of the reservation is what stops it, the same as in
+ * the interpreters. The extra megabyte is for the C functions it calls.
+ */
+#define NATIVE_FRAME_BYTES  64
+#define NATIVE_STACK_SIZE   ((size_t) STACK_RESERVE / (FRAME_HEADER + 1) * NATIVE_FRAME_BYTES + (1 << 20))
+
+static void emit_byte(Assembler& as, int byte)
+{
+    as.code.push_back((unsigned char) byte);
+}
+
+static void emit_int32(Assembler& as, int value)
+{
+    for (int i = 0; i < 4; i++)
+        emit_byte(as, (value >> (8 * i)) & 0xFF);
+}
+
+static void emit_int64(Assembler& as, long long value)
+{
+    for (int i = 0; i < 8; i++)
+        emit_byte(as, (value >> (8 * i)) & 0xFF);
+}
+
+// <opcode> reg, [base + disp32]
+static void emit_mem(Assembler& as, int opcode, int reg, int base, int disp)
+{
+    if (opcode > 0xFF)
+        emit_byte(as, opcode >> 8);
+    emit_byte(as, opcode & 0xFF);
+    emit_byte(as, 0x80 | (reg << 3) | base);
+    emit_int32(as, disp);
+}
+
+// <opcode> reg, <slot index>, from the register of the slot when it has one
+static void emit_slot(Assembler& as, int opcode, int reg, int index)
+{
+    int slot_register = index < as.registers.size() ? as.registers[index] : -1;
+    if (slot_register == -1)
+    {
+        emit_mem(as, opcode, reg, EBP, 4 * index);
+        return;
+    }
+    if (slot_register >= 8)
+        emit_byte(as, 0x41);                                // REX.B
+    if (opcode > 0xFF)
+        emit_byte(as, opcode >> 8);
+    emit_byte(as, opcode & 0xFF);
+    emit_byte(as, 0xC0 | (reg << 3) | (slot_register & 7));
+}
+
+// mov <register of index>, [rbp+4*index]
+static void emit_load(Assembler& as, int index)
+{
+    int slot_register = as.registers[index];
+    if (slot_register >= 8)
+        emit_byte(as, 0x44);                                // REX.R
+    emit_mem(as, 0x8B, slot_register & 7, EBP, 4 * index);
+}
+
+// Restores the registers pushed by compile_function
+static void emit_restore(Assembler& as)
+{
+    if (as.saved.size() % 2 == 1)
+    {
+        emit_byte(as, 0x48); emit_byte(as, 0x83);           // add rsp, 8
+        emit_byte(as, 0xC4); emit_byte(as, 0x08);
+    }
+    for (int i = as.saved.size() - 1; i >= 0; i--)
+    {
+        if (as.saved[i] >= 8)
+            emit_byte(as, 0x41);
+        emit_byte(as, 0x58 | (as.saved[i] & 7));            // pop
+    }
+}
+
+static void emit_jump(Assembler& as, int opcode, int target)
+{
+    if (opcode > 0xFF)
+        emit_byte(as, opcode >> 8);
+    emit_byte(as, opcode & 0xFF);
+    as.jumps.push_back(make_pair((int) as.code.size(), target));
+    emit_int32(as, 0);
+}
+
+// Jump to a later point of the same instruction, see patch_forward
+static int emit_forward(Assembler& as, int opcode)
+{
+    if (opcode > 0xFF)
+        emit_byte(as, opcode >> 8);
+    emit_byte(as, opcode & 0xFF);
+    emit_int32(as, 0);
+    return as.code.size() - 4;
+}
+
+// Makes the jump emitted by emit_forward land here
+static void patch_forward(Assembler& as, int position)
+{
+    int rel = as.code.size() - (position + 4);
+    memcpy(&as.code[position], &rel, 4);
+}
+
+// mov rax, function; call rax
+static void emit_call(Assembler& as, void* function)
+{
+    emit_byte(as, 0x48); emit_byte(as, 0xB8);
+    emit_int64(as, (long long) function);
+    emit_byte(as, 0xFF); emit_byte(as, 0xD0);
+}
+
+static void jit_print(int value)
+{
+    printf("%d ", value);
+}
+
+/*
+ * Commits more of the stack when the frame that rdi points to, which has
+ * size slots, doesn't fit in the committed part. Clobbers rax, rcx and rdx.
+ */
+static void emit_stack_check(Assembler& as, int size)
+{
+    emit_mem(as, 0x488D, EAX, EDI, 4 * size);              // lea rax, [rdi+4*size]
+    emit_byte(as, 0x48); emit_byte(as, 0xBA);               // mov rdx, &stack_limit
+    emit_int64(as, (long long) &stack_limit);
+    emit_byte(as, 0x48); emit_byte(as, 0x63); emit_byte(as, 0x12); // movsxd rdx, [rdx]
+    emit_byte(as, 0x48); emit_byte(as, 0xB9);               // mov rcx, mem
+    emit_int64(as, (long long) mem);
+    emit_byte(as, 0x48); emit_byte(as, 0x8D);               // lea rdx, [rcx+4*rdx]
+    emit_byte(as, 0x14); emit_byte(as, 0x91);
+    emit_byte(as, 0x48); emit_byte(as, 0x39); emit_byte(as, 0xD0); // cmp rax, rdx
+    emit_byte(as, 0x76); emit_byte(as, 25);                 // jbe over the slow path
+
+    emit_byte(as, 0x57); emit_byte(as, 0x57);               // push rdi (twice, keeps rsp aligned)
+    emit_byte(as, 0x48); emit_byte(as, 0x29); emit_byte(as, 0xC8); // sub rax, rcx
+    emit_byte(as, 0x48); emit_byte(as, 0xC1);               // shr rax, 2
+    emit_byte(as, 0xE8); emit_byte(as, 0x02);
+    emit_byte(as, 0x89); emit_byte(as, 0xC7);               // mov edi, eax
+    emit_call(as, (void*) &grow_stack);
+    emit_byte(as, 0x5F); emit_byte(as, 0x5F);               // pop rdi (twice)
+}
+
+/*
+ * Compares eax with the sorted case values [begin, end) of inst as a binary
+ * search and jumps to the case it finds or to the default.
+ */
+static void emit_case_search(Assembler& as, struct BytecodeProgram* program, const Instruction& inst,
+                             int begin, int end)
+{
+    if (end - begin <= 4)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            emit_byte(as, 0x3D);                            // cmp eax, value
+            emit_int32(as, program->case_values[inst.b + i]);
+            emit_jump(as, 0x0F84, program->case_targets[inst.b + i]); // je case
+        }
+        emit_jump(as, 0xE9, inst.target);                   // jmp default
+        return;
+    }
+
+    int middle = (begin + end) / 2;
+    emit_byte(as, 0x3D);
+    emit_int32(as, program->case_values[inst.b + middle]);
+    emit_jump(as, 0x0F84, program->case_targets[inst.b + middle]);
+    int lower = emit_forward(as, 0x0F8C);                   // jl lower
+    emit_case_search(as, program, inst, middle + 1, end);
+    patch_forward(as, lower);
+    emit_case_search(as, program, inst, begin, middle);
+}
+
+/*
+ * Branches of the CJMP at index after the cmp: holds jumps to inst.a and
+ * fails to inst.target. Whichever of them comes next is fallen through to.
+ */
+static void emit_branch(Assembler& as, int holds, int fails, const Instruction& inst, int index)
+{
+    if (inst.a == index + 1)
+        emit_jump(as, fails, inst.target);
+    else if (inst.target == index + 1)
+        emit_jump(as, holds, inst.a);
+    else
+    {
+        emit_jump(as, fails, inst.target);
+        emit_jump(as, 0xE9, inst.a);
+    }
+}
+
+static void compile_instruction(Assembler& as, struct BytecodeProgram* program,
+                                const Instruction& inst, int index)
+{
+    switch (inst.opcode)
+    {
+        case OP_NOOP:
+            break;
+        case OP_PRINT:
+            emit_slot(as, 0x8B, EDI, inst.a);               // mov edi, [rbp+a]
+            emit_call(as, (void*) &jit_print);
+            break;
+        case OP_ASSIGN_NONE:
+            emit_slot(as, 0x8B, EAX, inst.b);               // mov eax, [rbp+b]
+            emit_slot(as, 0x89, EAX, inst.a);               // mov [rbp+a], eax
+            break;
+        case OP_ASSIGN_PLUS:
+            emit_slot(as, 0x8B, EAX, inst.b);
+            emit_slot(as, 0x03, EAX, inst.c);               // add eax, [rbp+c]
+            emit_slot(as, 0x89, EAX, inst.a);
+            break;
+        case OP_ASSIGN_MINUS:
+            emit_slot(as, 0x8B, EAX, inst.b);
+            emit_slot(as, 0x2B, EAX, inst.c);               // sub eax, [rbp+c]
+            emit_slot(as, 0x89, EAX, inst.a);
+            break;
+        case OP_ASSIGN_MULT:
+            emit_slot(as, 0x8B, EAX, inst.b);
+            emit_slot(as, 0x0FAF, EAX, inst.c);             // imul eax, [rbp+c]
+            emit_slot(as, 0x89, EAX, inst.a);
+            break;
+        case OP_ASSIGN_DIV:
+            emit_slot(as, 0x8B, EAX, inst.b);
+            emit_byte(as, 0x99);                            // cdq
+            emit_slot(as, 0xF7, 7, inst.c);                 // idiv dword [rbp+c]
+            emit_slot(as, 0x89, EAX, inst.a);
+            break;
+        case OP_CJMP_GREATER:
+            emit_slot(as, 0x8B, EAX, inst.b);
+            emit_slot(as, 0x3B, EAX, inst.c);               // cmp eax, [rbp+c]
+            emit_branch(as, 0x0F8F, 0x0F8E, inst, index);   // jg a / jle target
+            break;
+        case OP_CJMP_LESS:
+            emit_slot(as, 0x8B, EAX, inst.b);
+            emit_slot(as, 0x3B, EAX, inst.c);
+            emit_branch(as, 0x0F8C, 0x0F8D, inst, index);   // jl a / jge target
+            break;
+        case OP_CJMP_NOTEQUAL:
+            emit_slot(as, 0x8B, EAX, inst.b);
+            emit_slot(as, 0x3B, EAX, inst.c);
+            emit_branch(as, 0x0F85, 0x0F84, inst, index);   // jne a / je target
+            break;
+        case OP_JMP:
+            emit_jump(as, 0xE9, inst.target);               // jmp target
+            break;
+        case OP_SWITCH_TABLE:
+            // The table holds the distance from each entry to its case
+            emit_slot(as, 0x8B, EAX, inst.a);               // mov eax, [rbp+a]
+            emit_byte(as, 0x2D); emit_int32(as, inst.c);    // sub eax, c
+            emit_byte(as, 0x3D); emit_int32(as, inst.d);    // cmp eax, d
+            emit_jump(as, 0x0F83, inst.target);             // jae default
+            emit_byte(as, 0x48); emit_byte(as, 0x8D);       // lea rcx, [rip+12]
+            emit_byte(as, 0x0D); emit_int32(as, 12);
+            emit_byte(as, 0x48); emit_byte(as, 0x8D);       // lea rcx, [rcx+4*rax]
+            emit_byte(as, 0x0C); emit_byte(as, 0x81);
+            emit_byte(as, 0x48); emit_byte(as, 0x63); emit_byte(as, 0x01); // movsxd rax, [rcx]
+            emit_byte(as, 0x48); emit_byte(as, 0x01); emit_byte(as, 0xC8); // add rax, rcx
+            emit_byte(as, 0xFF); emit_byte(as, 0xE0);       // jmp rax
+            for (int i = 0; i < inst.d; i++)
+            {
+                as.case_entries.push_back(make_pair((int) as.code.size(), program->case_targets[inst.b + i]));
+                emit_int32(as, 0);
+            }
+            break;
+        case OP_SWITCH_SEARCH:
+            emit_slot(as, 0x8B, EAX, inst.a);
+            emit_case_search(as, program, inst, 0, inst.d);
+            break;
+        case OP_CALL:
+        case OP_CALL_MEMO:
+        {
+            // Return addresses live on the native stack, so the header of
+            // the callee frame is left alone
+            const BytecodeFunction& callee = program->functions[inst.target];
+            emit_mem(as, 0x488D, EDI, EBP, 4 * inst.d);     // lea rdi, [rbp+4*d]
+            emit_stack_check(as, callee.frame_size);
+            emit_byte(as, 0x48); emit_byte(as, 0xBE);       // mov rsi, callee.frame_template
+            emit_int64(as, (long long) callee.frame_template);
+            for (int i = 0; i < callee.frame_size; i++)
+            {
+                emit_mem(as, 0x8B, EAX, ESI, 4 * i);        // mov eax, [rsi+4*i]
+                emit_mem(as, 0x89, EAX, EDI, 4 * i);        // mov [rdi+4*i], eax
+            }
+            for (int i = 0; i < inst.c; i++)
+            {
+                emit_slot(as, 0x8B, EAX, program->arguments[inst.b + i]);
+                emit_mem(as, 0x89, EAX, EDI, 4 * (i + 1));
+            }
+
+            int hit = -1;
+            if (inst.opcode == OP_CALL_MEMO)
+            {
+                // memo_lookup(cache, rdi + 4, [rsp]), keeping rdi and the
+                // alignment of rsp
+                emit_byte(as, 0x57);                        // push rdi
+                emit_byte(as, 0x48); emit_byte(as, 0x83);   // sub rsp, 8
+                emit_byte(as, 0xEC); emit_byte(as, 0x08);
+                emit_byte(as, 0x48); emit_byte(as, 0x8D);   // lea rsi, [rdi+4]
+                emit_byte(as, 0x77); emit_byte(as, 0x04);
+                emit_byte(as, 0x48); emit_byte(as, 0xBF);   // mov rdi, callee.cache
+                emit_int64(as, (long long) callee.cache);
+                emit_byte(as, 0x48); emit_byte(as, 0x89); emit_byte(as, 0xE2); // mov rdx, rsp
+                emit_call(as, (void*) &memo_lookup);
+                emit_byte(as, 0x8B); emit_byte(as, 0x0C); emit_byte(as, 0x24); // mov ecx, [rsp]
+                emit_byte(as, 0x48); emit_byte(as, 0x83);   // add rsp, 8
+                emit_byte(as, 0xC4); emit_byte(as, 0x08);
+                emit_byte(as, 0x5F);                        // pop rdi
+                emit_byte(as, 0x84); emit_byte(as, 0xC0);   // test al, al
+                hit = emit_forward(as, 0x0F85);             // jnz hit
+            }
+
+            emit_byte(as, 0xE8);                            // call function
+            as.calls.push_back(make_pair((int) as.code.size(), inst.target));
+            emit_int32(as, 0);
+            emit_slot(as, 0x89, EAX, inst.a);               // mov [rbp+4*a], eax
+
+            if (inst.opcode == OP_CALL_MEMO)
+            {
+                emit_byte(as, 0x89); emit_byte(as, 0xC6);   // mov esi, eax
+                emit_byte(as, 0x48); emit_byte(as, 0xBF);   // mov rdi, callee.cache
+                emit_int64(as, (long long) callee.cache);
+                emit_call(as, (void*) &memo_store);
+                int done = emit_forward(as, 0xE9);          // jmp done
+                patch_forward(as, hit);
+                emit_slot(as, 0x89, ECX, inst.a);           // hit: mov [rbp+4*a], ecx
+                patch_forward(as, done);
+            }
+            break;
+        }
+        case OP_TAILCALL:
+        {
+            // Same frame and same return address, so the callee is entered
+            // past its prologue, with the frame in memory and the registers
+            // of the caller back as they were
+            const BytecodeFunction& callee = program->functions[inst.target];
+            int scratch = inst.d > callee.frame_size ? inst.d : callee.frame_size;
+            emit_byte(as, 0x48); emit_byte(as, 0x89); emit_byte(as, 0xEF); // mov rdi, rbp
+            emit_stack_check(as, scratch + inst.c);
+            for (int i = 0; i < inst.c; i++)
+            {
+                emit_slot(as, 0x8B, EAX, program->arguments[inst.b + i]);
+                emit_mem(as, 0x89, EAX, EBP, 4 * (scratch + i));
+            }
+            emit_byte(as, 0x48); emit_byte(as, 0xBE);       // mov rsi, callee.frame_template
+            emit_int64(as, (long long) callee.frame_template);
+            for (int i = 0; i < callee.frame_size; i++)
+            {
+                emit_mem(as, 0x8B, EAX, ESI, 4 * i);
+                emit_mem(as, 0x89, EAX, EBP, 4 * i);
+            }
+            for (int i = 0; i < inst.c; i++)
+            {
+                emit_mem(as, 0x8B, EAX, EBP, 4 * (scratch + i));
+                emit_mem(as, 0x89, EAX, EBP, 4 * (i + 1));
+            }
+            emit_restore(as);
+            emit_byte(as, 0xE9);                            // jmp function
+            as.tail_calls.push_back(make_pair((int) as.code.size(), inst.target));
+            emit_int32(as, 0);
+            break;
+        }
+        case OP_RET:
+            emit_slot(as, 0x8B, EAX, 0);                    // mov eax, [rbp]
+            emit_restore(as);
+            emit_byte(as, 0x5D);                            // pop rbp
+            emit_byte(as, 0xC3);                            // ret
+            break;
+        case OP_HALT:
+            emit_restore(as);
+            emit_byte(as, 0x5D);
+            emit_byte(as, 0xC3);
+            break;
+        default:
+            debug("Error: invalid value for inst.opcode (%d).\n", inst.opcode);
+            exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Compiles code[begin..end) as one function. On entry rdi points to the new
+ * frame, which becomes rbp for the rest of the function. The slots given a
+ * register are loaded into it after the registers of the caller are saved,
+ * and are never written back, since nothing reads a frame once its function
+ * is done with it.
+ */
+static void compile_function(Assembler& as, struct BytecodeProgram* program,
+                             vector<int>& offsets, int begin, int end, int frame_size)
+{
+    vector<bool> live_at_entry;
+    allocate_registers(program, begin, end, frame_size, ALLOCATABLE_COUNT, as.registers, live_at_entry);
+    vector<bool> used(ALLOCATABLE_COUNT, false);
+    for (int i = 0; i < frame_size; i++)
+    {
+        if (as.registers[i] != -1)
+        {
+            used[as.registers[i]] = true;
+            as.registers[i] = allocatable[as.registers[i]];
+        }
+    }
+    as.saved.clear();
+    for (int r = 0; r < ALLOCATABLE_COUNT; r++)
+    {
+        if (used[r])
+            as.saved.push_back(allocatable[r]);
+    }
+
+    emit_byte(as, 0x55);                                    // push rbp
+    emit_byte(as, 0x48); emit_byte(as, 0x89); emit_byte(as, 0xFD); // mov rbp, rdi
+    for (int i = 0; i < as.saved.size(); i++)
+    {
+        if (as.saved[i] >= 8)
+            emit_byte(as, 0x41);
+        emit_byte(as, 0x50 | (as.saved[i] & 7));            // push
+    }
+    if (as.saved.size() % 2 == 1)
+    {
+        emit_byte(as, 0x48); emit_byte(as, 0x83);           // sub rsp, 8
+        emit_byte(as, 0xEC); emit_byte(as, 0x08);
+    }
+    for (int i = 0; i < frame_size; i++)
+    {
+        if (as.registers[i] != -1 && live_at_entry[i])
+            emit_load(as, i);
+    }
+
+    for (int i = begin; i < end; i++)
+    {
+        offsets[i] = as.code.size();
+        compile_instruction(as, program, program->code[i], i);
+    }
+}
+
+static void patch_rel32(Assembler& as, int position, int target)
+{
+    int rel = target - (position + 4);
+    memcpy(&as.code[position], &rel, 4);
+}
+
+/*
+ * Entered as trampoline(frame, stack_top): switches to the native stack
+ * that ends at stack_top, calls main with rdi still pointing to its frame
+ * and switches back.
+ */
+static int emit_trampoline(Assembler& as, int main_offset)
+{
+    int start = as.code.size();
+    emit_byte(as, 0x55);                                    // push rbp
+    emit_byte(as, 0x48); emit_byte(as, 0x89); emit_byte(as, 0xE5); // mov rbp, rsp
+    emit_byte(as, 0x48); emit_byte(as, 0x89); emit_byte(as, 0xF4); // mov rsp, rsi
+    emit_byte(as, 0xE8);                                    // call main
+    emit_int32(as, 0);
+    patch_rel32(as, as.code.size() - 4, main_offset);
+    emit_byte(as, 0x48); emit_byte(as, 0x89); emit_byte(as, 0xEC); // mov rsp, rbp
+    emit_byte(as, 0x5D);                                    // pop rbp
+    emit_byte(as, 0xC3);                                    // ret
+    return start;
+}
+
+bool execute_program_jit(struct BytecodeProgram* program)
+{
+    Assembler as;
+    vector<int> offsets(program->code.size(), -1);
+    vector<int> entries(program->functions.size(), -1);
+
+    // Lowering lays out main first and then every function in id order
+    int main_end = program->functions.empty() ? program->code.size() : program->functions[0].entry;
+    int main_offset = as.code.size();
+    compile_function(as, program, offsets, program->entry, main_end, program->frame_size);
+    for (int f = 0; f < program->functions.size(); f++)
+    {
+        int begin = program->functions[f].entry;
+        int end = f + 1 < program->functions.size() ? program->functions[f+1].entry : program->code.size();
+        entries[f] = as.code.size();
+        compile_function(as, program, offsets, begin, end, program->functions[f].frame_size);
+    }
+    int trampoline_offset = emit_trampoline(as, main_offset);
+
+    for (int i = 0; i < as.jumps.size(); i++)
+        patch_rel32(as, as.jumps[i].first, offsets[as.jumps[i].second]);
+    for (int i = 0; i < as.calls.size(); i++)
+        patch_rel32(as, as.calls[i].first, entries[as.calls[i].second]);
+    for (int i = 0; i < as.tail_calls.size(); i++)
+        patch_rel32(as, as.tail_calls[i].first, entries[as.tail_calls[i].second] + PROLOGUE_SIZE);
+    for (int i = 0; i < as.case_entries.size(); i++)
+    {
+        int distance = offsets[as.case_entries[i].second] - as.case_entries[i].first;
+        memcpy(&as.code[as.case_entries[i].first], &distance, 4);
+    }
+
+    void* buffer = mmap(NULL, as.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+        return false;
+    memcpy(buffer, &as.code[0], as.code.size());
+    if (mprotect(buffer, as.code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(buffer, as.code.size());
+        return false;
+    }
+
+    // Pages of the native stack are only committed once they are touched
+    void* stack = mmap(NULL, NATIVE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED)
+    {
+        munmap(buffer, as.code.size());
+        return false;
+    }
+
+    void (*entry)(int*, void*) = (void (*)(int*, void*)) ((unsigned char*) buffer + trampoline_offset);
+    entry(mem + frame_pointer, (unsigned char*) stack + NATIVE_STACK_SIZE);
+
+    munmap(stack, NATIVE_STACK_SIZE);
+    munmap(buffer, as.code.size());
+    return true;
+}
+
+// jcc to use after cmp for the CJMP opcode, when the condition holds or fails
+static int condition_jump(int opcode, bool holds)
+{
+    switch (opcode)
+    {
+        case OP_CJMP_GREATER:
+            return holds ? 0x0F8F : 0x0F8E;                 // jg / jle
+        case OP_CJMP_LESS:
+            return holds ? 0x0F8C : 0x0F8D;                 // jl / jge
+        default:
+            return holds ? 0x0F85 : 0x0F84;                 // jne / je
+    }
+}
+
+// Jump to a new exit of trace, see TraceExit
+static void emit_exit(Assembler& as, struct CompiledTrace* trace, vector<int>& exit_jumps, int opcode,
+                      int pc, int offset, const vector<pair<int, int> >& calls)
+{
+    TraceExit exit;
+    exit.pc = pc;
+    exit.offset = offset;
+    exit.calls = calls;
+    trace->exits.push_back(exit);
+    exit_jumps.push_back(emit_forward(as, opcode));
+}
+
+/*
+ * Compiles the steps of a trace as a loop over the frame rdi points to. The
+ * slots of every step are addressed from the frame the trace started in, so
+ * an inlined call is its frame template and arguments written at the offset
+ * of the callee, and its RET a copy of slot 0 to the caller. The headers of
+ * the callee frames are only written when the trace exits inside them.
+ * Nothing is kept in registers across steps.
+ */
+struct CompiledTrace* compile_trace(struct BytecodeProgram* program, const vector<TraceStep>& steps)
+{
+    Assembler as;
+    struct CompiledTrace* trace = new CompiledTrace;
+    trace->extent = 0;
+    vector<int> exit_jumps;
+    vector<pair<int, int> > calls;
+
+    emit_byte(as, 0x55);                                    // push rbp
+    emit_byte(as, 0x48); emit_byte(as, 0x89); emit_byte(as, 0xFD); // mov rbp, rdi
+    int loop = as.code.size();
+    for (int i = 0; i < steps.size(); i++)
+    {
+        const TraceStep& step = steps[i];
+        Instruction inst = program->code[step.pc];
+        int offset = step.offset;
+        switch (inst.opcode)
+        {
+            case OP_NOOP:
+            case OP_JMP:
+                break;
+            case OP_PRINT:
+            case OP_ASSIGN_NONE:
+            case OP_ASSIGN_PLUS:
+            case OP_ASSIGN_MINUS:
+            case OP_ASSIGN_MULT:
+            case OP_ASSIGN_DIV:
+                inst.a += offset;
+                inst.b += offset;
+                inst.c += offset;
+                compile_instruction(as, program, inst, step.pc);
+                break;
+            case OP_CJMP_GREATER:
+            case OP_CJMP_LESS:
+            case OP_CJMP_NOTEQUAL:
+                if (inst.a == inst.target)
+                    break;
+                emit_mem(as, 0x8B, EAX, EBP, 4 * (offset + inst.b));  // mov eax, [rbp+b]
+                emit_mem(as, 0x3B, EAX, EBP, 4 * (offset + inst.c));  // cmp eax, [rbp+c]
+                emit_exit(as, trace, exit_jumps, condition_jump(inst.opcode, step.next != inst.a),
+                          step.pc, offset, calls);
+                break;
+            case OP_SWITCH_TABLE:
+            case OP_SWITCH_SEARCH:
+                emit_mem(as, 0x8B, EAX, EBP, 4 * (offset + inst.a));
+                emit_byte(as, 0x3D); emit_int32(as, step.value);      // cmp eax, value
+                emit_exit(as, trace, exit_jumps, 0x0F85, step.pc, offset, calls); // jne exit
+                break;
+            case OP_CALL:
+            {
+                const BytecodeFunction& callee = program->functions[inst.target];
+                int callee_offset = offset + inst.d;
+                for (int j = 0; j < callee.frame_size; j++)
+                {
+                    emit_mem(as, 0xC7, 0, EBP, 4 * (callee_offset + j)); // mov dword [rbp+...], imm32
+                    emit_int32(as, callee.frame_template[j]);
+                }
+                for (int j = 0; j < inst.c; j++)
+                {
+                    emit_mem(as, 0x8B, EAX, EBP, 4 * (offset + program->arguments[inst.b + j]));
+                    emit_mem(as, 0x89, EAX, EBP, 4 * (callee_offset + j + 1));
+                }
+                trace->extent = max(trace->extent, callee_offset + callee.frame_size);
+                calls.push_back(make_pair(step.pc, offset));
+                break;
+            }
+            case OP_RET:
+            {
+                const Instruction& call = program->code[calls.back().first];
+                emit_mem(as, 0x8B, EAX, EBP, 4 * offset);
+                emit_mem(as, 0x89, EAX, EBP, 4 * (calls.back().second + call.a));
+                calls.pop_back();
+                break;
+            }
+            default:
+                // The recorder doesn't go through anything else
+                delete trace;
+                return NULL;
+        }
+    }
+    emit_byte(as, 0xE9);                                    // jmp loop
+    emit_int32(as, loop - ((int) as.code.size() + 4));
+
+    for (int i = 0; i < exit_jumps.size(); i++)
+    {
+        patch_forward(as, exit_jumps[i]);
+        emit_byte(as, 0xB8); emit_int32(as, i);             // mov eax, i
+        emit_byte(as, 0x5D);                                // pop rbp
+        emit_byte(as, 0xC3);                                // ret
+    }
+
+    // Traces stay around until the program ends
+    void* buffer = mmap(NULL, as.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+    {
+        delete trace;
+        return NULL;
+    }
+    memcpy(buffer, &as.code[0], as.code.size());
+    if (mprotect(buffer, as.code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(buffer, as.code.size());
+        delete trace;
+        return NULL;
+    }
+    trace->code = (int (*)(int*)) buffer;
+    return trace;
+}
+
+#else
+
+bool execute_program_jit(struct BytecodeProgram* program)
+{
+    return false;
+}
+
+struct CompiledTrace* compile_trace(struct BytecodeProgram* program, const vector<TraceStep>& steps)
+{
+    return NULL;
+}
+
+#endif
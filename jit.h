@@ -0,0 +1,59 @@
+#ifndef __JIT__H__
+#define __JIT__H__
+
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+
+using namespace std;
+
+/*
+ * Baseline JIT for x86-64. Every function of the program and main are
+ * compiled to native code, one template per bytecode instruction, with the
+ * slots of the current frame addressed as [rbp + 4 * index] unless the
+ * register allocator gave them a register.
+ *
+ * Returns false without running anything when the program can't be compiled
+ * on this machine, in which case the caller should interpret it instead.
+ */
+bool execute_program_jit(struct BytecodeProgram* program);
+
+/*
+ * Tracing JIT (trace.cc). The interpreter counts the backward jumps of every
+ * loop, and once one is hot records the instructions one iteration runs,
+ * going into the functions it calls. The trace is compiled to native code
+ * that runs the iteration again and again, with a guard at every condition
+ * and SWITCH checking that it goes the way it did when recorded. A guard
+ * that fails hands the program back to the interpreter.
+ */
+struct TraceStep
+{
+    int pc;                             // instruction run
+    int offset;                         // its frame, in slots from the frame the trace started in
+    int next;                           // instruction run after it
+    int value;                          // operand of a SWITCH
+};
+
+struct TraceExit
+{
+    int pc;                             // instruction the interpreter runs again
+    int offset;                         // its frame, as in TraceStep
+    vector<pair<int, int> > calls;      // inlined calls around it, outermost first:
+                                        // index of the call and offset of its caller
+};
+
+struct CompiledTrace
+{
+    int (*code)(int* frame);            // returns the index of the exit taken
+    vector<TraceExit> exits;
+    int extent;                         // slots past the frame the trace may write
+};
+
+// The steps have to go around the loop: the last one goes back to the first
+// at offset 0. Returns NULL when they can't be compiled on this machine.
+struct CompiledTrace* compile_trace(struct BytecodeProgram* program, const vector<TraceStep>& steps);
+
+void execute_program_traced(struct BytecodeProgram* program);
+
+#endif  //__JIT__H__
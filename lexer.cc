@@ -7,10 +7,11 @@
 #include <istream>
 #include <vector>
 #include <string>
-#include <cctype>
+#include <cstring>
 
 #include "lexer.h"
 #include "inputbuf.h"
+#include "scan.h"
 
 using namespace std;
 
@@ -25,6 +26,132 @@ string reserved[] = { "END_OF_FILE",
 
 #define KEYWORDS_COUNT 9
 
+// ------- scanner tables -------------------
+//
+// GetTokenMain is a DFA over classes of characters. Every state but
+// STATE_START is the end of a token, which is the longest run of characters
+// the transitions allow. Spaces and the runs of letters and digits are
+// skipped with the kernels in scan.cc rather than one transition at a time.
+
+enum CharClass {
+    CLASS_SPACE, CLASS_NEWLINE,         // skipped by SkipSpace
+    CLASS_LETTER, CLASS_ZERO, CLASS_DIGIT, CLASS_LESS, CLASS_GREATER, CLASS_PUNCT, CLASS_OTHER,
+    CLASS_END,                          // past the last character
+    CLASS_COUNT
+};
+
+enum ScanState {
+    STATE_START, STATE_ID, STATE_ZERO, STATE_NUM, STATE_LESS, STATE_NOTEQUAL, STATE_PUNCT, STATE_OTHER,
+    STATE_STOP,                         // the token ended at the previous character
+    STATE_COUNT = STATE_STOP
+};
+
+struct ScannerTables {
+    unsigned char char_class[256];
+    unsigned char punctuation[256];     // token of each CLASS_PUNCT and CLASS_GREATER character
+    unsigned char transition[STATE_COUNT][CLASS_COUNT];
+};
+
+static constexpr ScannerTables build_scanner_tables()
+{
+    ScannerTables tables = {};
+    for (int c = 0; c < 256; c++)
+    {
+        tables.char_class[c] = CLASS_OTHER;
+        tables.punctuation[c] = ERROR;
+    }
+    const char* spaces = " \t\v\f\r";
+    for (int i = 0; spaces[i] != '\0'; i++)
+        tables.char_class[(unsigned char) spaces[i]] = CLASS_SPACE;
+    tables.char_class['\n'] = CLASS_NEWLINE;
+    for (int c = 'a'; c <= 'z'; c++)
+        tables.char_class[c] = CLASS_LETTER;
+    for (int c = 'A'; c <= 'Z'; c++)
+        tables.char_class[c] = CLASS_LETTER;
+    tables.char_class['0'] = CLASS_ZERO;
+    for (int c = '1'; c <= '9'; c++)
+        tables.char_class[c] = CLASS_DIGIT;
+    tables.char_class['<'] = CLASS_LESS;
+    tables.char_class['>'] = CLASS_GREATER;
+
+    const char* punctuation = "+-/*=:,;[](){}>";
+    const TokenType tokens[] = { PLUS, MINUS, DIV, MULT, EQUAL, COLON, COMMA, SEMICOLON,
+                                 LBRAC, RBRAC, LPAREN, RPAREN, LBRACE, RBRACE, GREATER };
+    for (int i = 0; punctuation[i] != '\0'; i++)
+    {
+        if (punctuation[i] != '>')
+            tables.char_class[(unsigned char) punctuation[i]] = CLASS_PUNCT;
+        tables.punctuation[(unsigned char) punctuation[i]] = tokens[i];
+    }
+
+    for (int state = 0; state < STATE_COUNT; state++)
+    {
+        for (int c = 0; c < CLASS_COUNT; c++)
+            tables.transition[state][c] = STATE_STOP;
+    }
+    tables.transition[STATE_START][CLASS_LETTER] = STATE_ID;
+    tables.transition[STATE_START][CLASS_ZERO] = STATE_ZERO;        // 0 is a number on its own
+    tables.transition[STATE_START][CLASS_DIGIT] = STATE_NUM;
+    tables.transition[STATE_START][CLASS_LESS] = STATE_LESS;
+    tables.transition[STATE_START][CLASS_GREATER] = STATE_PUNCT;
+    tables.transition[STATE_START][CLASS_PUNCT] = STATE_PUNCT;
+    tables.transition[STATE_START][CLASS_OTHER] = STATE_OTHER;
+    tables.transition[STATE_ID][CLASS_LETTER] = STATE_ID;
+    tables.transition[STATE_ID][CLASS_ZERO] = STATE_ID;
+    tables.transition[STATE_ID][CLASS_DIGIT] = STATE_ID;
+    tables.transition[STATE_NUM][CLASS_ZERO] = STATE_NUM;
+    tables.transition[STATE_NUM][CLASS_DIGIT] = STATE_NUM;
+    tables.transition[STATE_LESS][CLASS_GREATER] = STATE_NOTEQUAL;
+    return tables;
+}
+
+static constexpr ScannerTables scanner = build_scanner_tables();
+
+// Keywords are found with a perfect hash of their first two characters and
+// length, checked at compile time to put each in a slot of its own.
+// keyword[i] is the text of TokenType i + 1.
+static constexpr const char* keyword[KEYWORDS_COUNT] = {
+    "VAR", "FOR", "IF", "WHILE", "SWITCH", "CASE", "DEFAULT", "print", "ARRAY"
+};
+
+#define KEYWORD_TABLE_SIZE 16
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 7
+
+static constexpr int keyword_hash(const char* s, int length)
+{
+    return ((unsigned char) s[0] + (unsigned char) s[1] + 6 * length) % KEYWORD_TABLE_SIZE;
+}
+
+struct KeywordTable {
+    int index[KEYWORD_TABLE_SIZE];      // into keyword, -1 for none
+    int length[KEYWORDS_COUNT];
+    bool perfect;
+};
+
+static constexpr KeywordTable build_keyword_table()
+{
+    KeywordTable table = {};
+    table.perfect = true;
+    for (int h = 0; h < KEYWORD_TABLE_SIZE; h++)
+        table.index[h] = -1;
+    for (int i = 0; i < KEYWORDS_COUNT; i++)
+    {
+        int length = 0;
+        while (keyword[i][length] != '\0')
+            length++;
+        table.length[i] = length;
+        int h = keyword_hash(keyword[i], length);
+        if (table.index[h] != -1 || length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH)
+            table.perfect = false;
+        table.index[h] = i;
+    }
+    return table;
+}
+
+static constexpr KeywordTable keyword_table = build_keyword_table();
+static_assert(keyword_table.perfect, "keyword_hash has to give every keyword a slot of its own");
+
 void Token::Print()
 {
     cout << "{" << this->lexeme << " , "
@@ -32,137 +159,105 @@ void Token::Print()
          << this->line_no << "}\n";
 }
 
+SymbolTable::SymbolTable()
+{
+    Intern("");
+}
+
+int SymbolTable::Intern(string_view text)
+{
+    unordered_map<string_view, int>::iterator found = ids.find(text);
+    if (found != ids.end())
+        return found->second;
+    names.push_back(string(text));
+    ids[names.back()] = names.size() - 1;
+    return names.size() - 1;
+}
+
+int SymbolTable::Find(string_view text) const
+{
+    unordered_map<string_view, int>::const_iterator found = ids.find(text);
+    return found == ids.end() ? -1 : found->second;
+}
+
 LexicalAnalyzer::LexicalAnalyzer()
 {
     this->line_no = 1;
-    tmp.lexeme = "";
+    for (int i = 0; i < KEYWORDS_COUNT; i++)    // symbol of a keyword is its TokenType
+        symbols.Intern(keyword[i]);
+    SetLexeme(0);
     tmp.line_no = 1;
     tmp.token_type = ERROR;
 
-    Token token = GetTokenMain();
     index = 0;
+    scanned = 0;
+    at_end = false;
+}
 
-    while (token.token_type != END_OF_FILE)
+// Scans tokens until count of them have been scanned, returns false if the
+// input ends first. END_OF_FILE is not put in the window.
+bool LexicalAnalyzer::Scan(int count)
+{
+    while (scanned < count && !at_end)
     {
-        tokenList.push_back(token);     // push token into internal list
-        token = GetTokenMain();        // and get next token from standatd input
+        Token token = GetTokenMain();
+        if (token.token_type == END_OF_FILE)
+            at_end = true;
+        else
+            window[scanned++ % LEXER_WINDOW] = token;
     }
-    // pushes END_OF_FILE is not pushed on the token list
+    return scanned >= count;
 }
 
-bool LexicalAnalyzer::SkipSpace()
+Token LexicalAnalyzer::EndOfFile()
 {
-    char c;
-    bool space_encountered = false;
-
-    input.GetChar(c);
-    line_no += (c == '\n');
-
-    while (!input.EndOfInput() && isspace(c)) {
-        space_encountered = true;
-        input.GetChar(c);
-        line_no += (c == '\n');
-    }
-
-    if (!input.EndOfInput()) {
-        input.UngetChar(c);
-    }
-    return space_encountered;
+    Token token;
+    token.lexeme = symbols.Name(0);
+    token.symbol = 0;
+    token.line_no = line_no;
+    token.token_type = END_OF_FILE;
+    return token;
 }
 
-int LexicalAnalyzer::FindKeywordIndex(string s)
+// Moves past spaces and counts the lines on the way, returns whether there
+// were any
+bool LexicalAnalyzer::SkipSpace()
 {
-    string keyword[] = { "VAR", "FOR", "IF", "WHILE", "SWITCH", "CASE", "DEFAULT", "print", "ARRAY" };
-    for (int i = 0; i < KEYWORDS_COUNT; i++) {
-        if (s == keyword[i]) {
-            return i + 1;
-        }
-    }
-    return -1;
+    const char* start = input.Position();
+    const char* p = skip_space(start, input.Limit(), &line_no);
+    input.Seek(p);
+    return p != start;
 }
 
-Token LexicalAnalyzer::ScanNumber()
+void LexicalAnalyzer::SetLexeme(int symbol)
 {
-    char c;
-
-    input.GetChar(c);
-    if (isdigit(c)) {
-        if (c == '0') {
-            tmp.lexeme = "0";
-        } else {
-            tmp.lexeme = "";
-            while (!input.EndOfInput() && isdigit(c)) {
-                tmp.lexeme += c;
-                input.GetChar(c);
-            }
-            if (!input.EndOfInput()) {
-                input.UngetChar(c);
-            }
-        }
-        tmp.token_type = NUM;
-        tmp.line_no = line_no;
-        return tmp;
-    } else {
-        if (!input.EndOfInput()) {
-            input.UngetChar(c);
-        }
-        tmp.lexeme = "";
-        tmp.token_type = ERROR;
-        tmp.line_no = line_no;
-        return tmp;
-    }
+    tmp.symbol = symbol;
+    tmp.lexeme = symbols.Name(symbol);
 }
 
-Token LexicalAnalyzer::ScanIdOrKeyword()
+// Returns the TokenType of the keyword s, -1 if it isn't one
+int LexicalAnalyzer::FindKeywordIndex(const char* s, int length)
 {
-    char c;
-    input.GetChar(c);
-
-    if (isalpha(c)) {
-        tmp.lexeme = "";
-        while (!input.EndOfInput() && isalnum(c)) {
-            tmp.lexeme += c;
-            input.GetChar(c);
-        }
-        if (!input.EndOfInput()) {
-            input.UngetChar(c);
-        }
-        tmp.line_no = line_no;
-        int keywordIndex = FindKeywordIndex(tmp.lexeme);
-        if (keywordIndex != -1)
-            tmp.token_type = (TokenType) keywordIndex;
-        else
-            tmp.token_type = ID;
-    } else {
-        if (!input.EndOfInput()) {
-            input.UngetChar(c);
-        }
-        tmp.lexeme = "";
-        tmp.token_type = ERROR;
-    }
-    return tmp;
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH)
+        return -1;
+    int i = keyword_table.index[keyword_hash(s, length)];
+    if (i != -1 && keyword_table.length[i] == length && memcmp(s, keyword[i], length) == 0)
+        return i + 1;
+    return -1;
 }
 
-// GetToken() accesses tokens from the tokenList that is populated when a 
-// lexer object is instantiated
+// GetToken() scans the next token if it isn't in the window yet
 Token LexicalAnalyzer::GetToken()
 {
-    Token token;
-    if (index == tokenList.size()){       // return end of file if
-        token.lexeme = "";                // index is too large
-        token.line_no = line_no;
-        token.token_type = END_OF_FILE;
-    }
-    else{
-        token = tokenList[index];
-        index = index + 1;
-    }
-    return token;
+    if (!Scan(index + 1))                 // return end of file if
+        return EndOfFile();               // the input ended
+    return window[index++ % LEXER_WINDOW];
 }
 
 // UngetToken() resets the index back by a amount equal to its argument 
 // "howMany". "howMany" should be positive and not larger than the 
-// actual number of valid tokens that were obtained using GetToken()
+// actual number of valid tokens that were obtained using GetToken(), and
+// the tokens have to still be in the window
 //
 // NOTE 1: UngetToken() unget actual tokens. So, if you call GetToken() twice
 // and for both call you get END_OF_FILE UngetToken(2) will return the last 
@@ -180,79 +275,82 @@ void LexicalAnalyzer::UngetToken(int howMany)
     }
 
     index = index - howMany; // update index
-    if (index < 0)           // and panic if resulting index is negative
-    {
+    if (index < 0 || index < scanned - LEXER_WINDOW) // and panic if resulting index
+    {                                                // is outside of the window
         cout << "LexicalAnalyzer:UngetToken:Error: large  argument\n";
         exit(-1);
     }
 }
 
-// peek requires that the argument "howFar" be positive.
+// peek requires that the argument "howFar" be positive and not larger than
+// LEXER_WINDOW.
 Token LexicalAnalyzer::peek(int howFar)
 {
     if (howFar <= 0) {      // peeking backward or in place is not allowed
         cout << "LexicalAnalyzer:peek:Error: non positive argument\n";
         exit(-1);
     }
+    if (howFar > LEXER_WINDOW) {
+        cout << "LexicalAnalyzer:peek:Error: argument larger than the window\n";
+        exit(-1);
+    }
 
     int peekIndex = index + howFar - 1;
-    if (peekIndex > (tokenList.size()-1)) { // if peeking too far
-        Token token;                        // return END_OF_FILE
-        token.lexeme = "";
-        token.line_no = line_no;
-        token.token_type = END_OF_FILE;
-        return token;
-    } else
-        return tokenList[peekIndex];
+    if (!Scan(peekIndex + 1))   // if peeking past the end of input
+        return EndOfFile();     // return END_OF_FILE
+    return window[peekIndex % LEXER_WINDOW];
 }
 
 Token LexicalAnalyzer::GetTokenMain()
 {
-    char c;
-
     SkipSpace();
-    tmp.lexeme = "";
     tmp.line_no = line_no;
-    input.GetChar(c);
-    switch (c) {
-        case '+':   tmp.token_type = PLUS;      return tmp;
-        case '-':   tmp.token_type = MINUS;     return tmp;
-        case '/':   tmp.token_type = DIV;       return tmp;
-        case '*':   tmp.token_type = MULT;      return tmp;
-        case '=':   tmp.token_type = EQUAL;     return tmp;
-        case ':':   tmp.token_type = COLON;     return tmp;
-        case ',':   tmp.token_type = COMMA;     return tmp;
-        case ';':   tmp.token_type = SEMICOLON; return tmp;
-        case '[':   tmp.token_type = LBRAC;     return tmp;
-        case ']':   tmp.token_type = RBRAC;     return tmp;
-        case '(':   tmp.token_type = LPAREN;    return tmp;
-        case ')':   tmp.token_type = RPAREN;    return tmp;
-        case '{':   tmp.token_type = LBRACE;    return tmp;
-        case '}':   tmp.token_type = RBRACE;    return tmp;
-        case '>':   tmp.token_type = GREATER;   return tmp;
-        case '<':
-            input.GetChar(c);
-            if (c == '>') {
-                tmp.token_type = NOTEQUAL;
+
+    const unsigned char* start = (const unsigned char*) input.Position();
+    const unsigned char* limit = (const unsigned char*) input.Limit();
+    const unsigned char* p = start;
+    int state = STATE_START;
+    while (true) {
+        int char_class = p < limit ? scanner.char_class[*p] : (int) CLASS_END;
+        int next = scanner.transition[state][char_class];
+        if (next == STATE_STOP)
+            break;
+        state = next;
+        p++;
+        // The states that loop on themselves go to the end of the run at once
+        if (state == STATE_ID)
+            p = (const unsigned char*) skip_identifier((const char*) p, (const char*) limit);
+        else if (state == STATE_NUM)
+            p = (const unsigned char*) skip_digits((const char*) p, (const char*) limit);
+    }
+    input.Seek((const char*) p);
+
+    const char* text = (const char*) start;
+    int length = p - start;
+    SetLexeme(0);
+    switch (state) {
+        case STATE_START:   tmp.token_type = END_OF_FILE;   break;
+        case STATE_LESS:    tmp.token_type = LESS;          break;
+        case STATE_NOTEQUAL: tmp.token_type = NOTEQUAL;     break;
+        case STATE_PUNCT:   tmp.token_type = (TokenType) scanner.punctuation[*start]; break;
+        case STATE_OTHER:   tmp.token_type = ERROR;         break;
+        case STATE_ZERO:
+        case STATE_NUM:
+            SetLexeme(symbols.Intern(string_view(text, length)));
+            tmp.token_type = NUM;
+            break;
+        case STATE_ID:
+        {
+            int keywordIndex = FindKeywordIndex(text, length);
+            if (keywordIndex != -1) {
+                SetLexeme(keywordIndex);
+                tmp.token_type = (TokenType) keywordIndex;
             } else {
-                if (!input.EndOfInput()) {
-                    input.UngetChar(c);
-                }
-                tmp.token_type = LESS;
+                SetLexeme(symbols.Intern(string_view(text, length)));
+                tmp.token_type = ID;
             }
-            return tmp;
-        default:
-            if (isdigit(c)) {
-                input.UngetChar(c);
-                return ScanNumber();
-            } else if (isalpha(c)) {
-                input.UngetChar(c);
-                return ScanIdOrKeyword();
-            } else if (input.EndOfInput())
-                tmp.token_type = END_OF_FILE;
-            else
-                tmp.token_type = ERROR;
-
-            return tmp;
+            break;
+        }
     }
+    return tmp;
 }
@@ -6,8 +6,11 @@
 #ifndef __LEXER__H__
 #define __LEXER__H__
 
-#include <vector>
+#include <deque>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "inputbuf.h"
 
@@ -26,11 +29,37 @@ class Token {
   public:
     void Print();
 
-    std::string lexeme;
+    std::string_view lexeme;    // text of symbol, owned by the SymbolTable
+    int symbol;
     TokenType token_type;
     int line_no;
 };
 
+/*
+ * Every distinct lexeme is stored once and numbered in the order it is first
+ * seen, so tokens carry a view of the stored text and its number instead of
+ * a copy. Symbol 0 is the empty lexeme of punctuation and END_OF_FILE.
+ */
+class SymbolTable {
+  public:
+    SymbolTable();
+    int Intern(std::string_view text);
+    int Find(std::string_view text) const;      // -1 if text was never interned
+    std::string_view Name(int symbol) const { return names[symbol]; }
+    int Count() const { return names.size(); }
+
+  private:
+    std::deque<std::string> names;  // a deque doesn't move its strings
+    std::unordered_map<std::string_view, int> ids;
+};
+
+/*
+ * Tokens are scanned from the input as the parser asks for them and kept in
+ * a ring of the last LEXER_WINDOW ones, so peek can look up to LEXER_WINDOW
+ * tokens ahead and UngetToken can go back over the tokens still in the ring.
+ */
+#define LEXER_WINDOW 8
+
 class LexicalAnalyzer {
   public:
     Token GetToken();
@@ -38,18 +67,23 @@ class LexicalAnalyzer {
     Token peek(int);
     LexicalAnalyzer();
 
+    SymbolTable symbols;
+
   private:
-    std::vector<Token> tokenList;
+    Token window[LEXER_WINDOW];
+    int scanned;                // tokens scanned so far, token i is window[i % LEXER_WINDOW]
+    bool at_end;                // GetTokenMain returned END_OF_FILE
     Token GetTokenMain();
+    bool Scan(int count);
+    Token EndOfFile();
     int line_no;
     int index;
     Token tmp;
     InputBuffer input;
 
+    void SetLexeme(int symbol);
     bool SkipSpace();
-    int FindKeywordIndex(std::string);
-    Token ScanIdOrKeyword();
-    Token ScanNumber();
+    int FindKeywordIndex(const char*, int);
 };
 
 #endif  //__LEXER__H__
@@ -0,0 +1,806 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "compiler.h"
+#include "optimizer.h"
+#include "cfg.h"
+
+using namespace std;
+
+/*
+ * Loop optimizations. Loops are found from the back edges of the CFG, so
+ * WHILE and FOR loops are handled alike, innermost first. Statements that
+ * move out of a loop go to a preheader: a chain of nodes that every edge
+ * entering the loop from outside now goes through.
+ */
+
+struct LoopInfo
+{
+    Function* function;
+    ControlFlowGraph cfg;
+    Loop loop;
+    set<InstructionNode*> nodes;        // nodes of the loop's blocks
+    vector<bool> live_at_header;
+    vector<bool> live_at_exits;         // live where the loop can be left
+    vector<int> defs;                   // writes inside the loop, per slot
+    vector<int> defs_in_body;           // writes anywhere in the body
+    vector<InstructionNode*> preheader;
+};
+
+// Slots added to the frame while optimizing are only written before the loop
+static void add_slot(LoopInfo& info, int slot)
+{
+    int frame_size = slot + 1;
+    if (info.defs.size() >= frame_size)
+        return;
+    info.live_at_header.resize(frame_size, false);
+    info.live_at_exits.resize(frame_size, false);
+    info.defs.resize(frame_size, 0);
+    info.defs_in_body.resize(frame_size, 0);
+}
+
+// Holds the same value every time the loop reads it
+static bool is_invariant(const LoopInfo& info, int slot)
+{
+    return info.defs[slot] == 0;
+}
+
+// Never written, so it keeps the value of the frame template
+static bool is_constant_slot(const LoopInfo& info, int slot)
+{
+    return info.defs_in_body[slot] == 0 && slot > info.function->parameter_count;
+}
+
+/*
+ * An invariant ASSIGN can run once before the loop when it is the only write
+ * to its slot in the loop, the loop never reads what the slot held before
+ * the loop started and nothing after the loop reads it either. A division
+ * that could trap stays put since the loop might not have run it at all.
+ */
+static bool can_hoist(const LoopInfo& info, struct InstructionNode* node)
+{
+    if (node->type != ASSIGN)
+        return false;
+    int lhs = node->assign_inst.left_hand_side_index;
+    if (info.defs[lhs] != 1 || info.live_at_header[lhs] || info.live_at_exits[lhs])
+        return false;
+
+    vector<int> uses;
+    node_uses(node, uses);
+    for (int i = 0; i < uses.size(); i++)
+    {
+        if (!is_invariant(info, uses[i]))
+            return false;
+    }
+
+    if (node->assign_inst.op == OPERATOR_DIV)
+    {
+        int divisor = node->assign_inst.operand2_index;
+        if (!is_constant_slot(info, divisor))
+            return false;
+        int value = info.function->localMem[divisor];
+        if (value == 0 || value == -1)
+            return false;
+    }
+    return true;
+}
+
+static struct InstructionNode* new_assign(int lhs, int operand1, ArithmeticOperatorType op, int operand2)
+{
+    struct InstructionNode* node = new InstructionNode;
+    node->type = ASSIGN;
+    node->assign_inst.left_hand_side_index = lhs;
+    node->assign_inst.operand1_index = operand1;
+    node->assign_inst.operand2_index = operand2;
+    node->assign_inst.op = op;
+    node->next = NULL;
+    return node;
+}
+
+static void hoist_invariants(LoopInfo& info)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int b = 0; b < info.cfg.blocks.size(); b++)
+        {
+            if (!info.loop.blocks[b])
+                continue;
+            vector<InstructionNode*>& nodes = info.cfg.blocks[b].nodes;
+            for (int i = 0; i < nodes.size(); i++)
+            {
+                if (!can_hoist(info, nodes[i]))
+                    continue;
+                info.preheader.push_back(new InstructionNode(*nodes[i]));
+                info.defs[nodes[i]->assign_inst.left_hand_side_index] = 0;
+                nodes[i]->type = NOOP;
+                changed = true;
+            }
+        }
+    }
+}
+
+// A write "i = i + k", "i = k + i" or "i = i - k" with k invariant. step is
+// set to k and negate to whether it is subtracted.
+static bool is_induction_step(const LoopInfo& info, struct InstructionNode* node, int slot, int* step, bool* negate)
+{
+    if (node->type != ASSIGN || node->assign_inst.left_hand_side_index != slot)
+        return false;
+    int left = node->assign_inst.operand1_index;
+    int right = node->assign_inst.operand2_index;
+    if (node->assign_inst.op == OPERATOR_PLUS && left == slot && is_invariant(info, right))
+        *step = right;
+    else if (node->assign_inst.op == OPERATOR_PLUS && right == slot && is_invariant(info, left))
+        *step = left;
+    else if (node->assign_inst.op == OPERATOR_MINUS && left == slot && is_invariant(info, right))
+        *step = right;
+    else
+        return false;
+    *negate = node->assign_inst.op == OPERATOR_MINUS;
+    return true;
+}
+
+// Every write to slot in the loop is an induction step
+static bool is_induction_variable(const LoopInfo& info, int slot, vector<InstructionNode*>& steps)
+{
+    if (info.defs[slot] == 0)
+        return false;
+    for (int b = 0; b < info.cfg.blocks.size(); b++)
+    {
+        if (!info.loop.blocks[b])
+            continue;
+        const vector<InstructionNode*>& nodes = info.cfg.blocks[b].nodes;
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            int step;
+            bool negate;
+            if (node_def(nodes[i]) != slot)
+                continue;
+            if (!is_induction_step(info, nodes[i], slot, &step, &negate))
+                return false;
+            steps.push_back(nodes[i]);
+        }
+    }
+    return true;
+}
+
+// True when some path from after step reads slot before running product
+// (or going around the loop)
+static bool read_before(const LoopInfo& info, struct InstructionNode* step, struct InstructionNode* product, int slot)
+{
+    struct InstructionNode* header = info.cfg.blocks[info.loop.header].nodes[0];
+    set<InstructionNode*> seen;
+    vector<InstructionNode*> work;
+    node_successors(step, work);
+    while (!work.empty())
+    {
+        struct InstructionNode* node = work.back();
+        work.pop_back();
+        if (node == NULL || node == product || node == header || !seen.insert(node).second)
+            continue;
+        if (!info.nodes.count(node))
+            continue;
+        vector<int> uses;
+        node_uses(node, uses);
+        for (int i = 0; i < uses.size(); i++)
+        {
+            if (uses[i] == slot)
+                return true;
+        }
+        node_successors(node, work);
+    }
+    return false;
+}
+
+/*
+ * "t = i * c" with i an induction variable and c invariant becomes a running
+ * product: t is computed once in the preheader and every step of i adds
+ * (or subtracts) c times its step to t. This is only done when t is not
+ * read between a step of i and the multiplication, since t would already
+ * hold the next value there.
+ */
+static void reduce_strength(LoopInfo& info)
+{
+    for (int b = 0; b < info.cfg.blocks.size(); b++)
+    {
+        if (!info.loop.blocks[b])
+            continue;
+        vector<InstructionNode*>& nodes = info.cfg.blocks[b].nodes;
+        for (int n = 0; n < nodes.size(); n++)
+        {
+            struct InstructionNode* product = nodes[n];
+            if (product->type != ASSIGN || product->assign_inst.op != OPERATOR_MULT)
+                continue;
+            int lhs = product->assign_inst.left_hand_side_index;
+            if (info.defs[lhs] != 1 || info.live_at_header[lhs] || info.live_at_exits[lhs])
+                continue;
+
+            int variable = product->assign_inst.operand1_index;
+            int factor = product->assign_inst.operand2_index;
+            if (!is_invariant(info, factor))
+                swap(variable, factor);
+            if (!is_invariant(info, factor) || variable == lhs)
+                continue;
+            vector<InstructionNode*> steps;
+            if (!is_induction_variable(info, variable, steps))
+                continue;
+
+            bool safe = true;
+            for (int i = 0; i < steps.size() && safe; i++)
+                safe = !read_before(info, steps[i], product, lhs);
+            if (!safe)
+                continue;
+
+            info.preheader.push_back(new_assign(lhs, variable, OPERATOR_MULT, factor));
+            for (int i = 0; i < steps.size(); i++)
+            {
+                int step;
+                bool negate;
+                is_induction_step(info, steps[i], variable, &step, &negate);
+
+                int increment;
+                if (is_constant_slot(info, step) && is_constant_slot(info, factor))
+                {
+                    unsigned value = (unsigned) info.function->localMem[step] * (unsigned) info.function->localMem[factor];
+                    increment = constant_slot(info.function, (int) value);
+                    add_slot(info, increment);
+                }
+                else
+                {
+                    increment = temp_slot(info.function);
+                    add_slot(info, increment);
+                    info.preheader.push_back(new_assign(increment, step, OPERATOR_MULT, factor));
+                }
+
+                struct InstructionNode* update = new_assign(lhs, lhs, negate ? OPERATOR_MINUS : OPERATOR_PLUS, increment);
+                update->next = steps[i]->next;
+                steps[i]->next = update;
+                info.nodes.insert(update);
+            }
+            product->type = NOOP;
+            info.defs[lhs] = steps.size();
+        }
+    }
+}
+
+/*
+ * Closed form of counted loops. When a loop is a CJMP on an induction
+ * variable followed by a straight run of ASSIGNs, every slot it writes holds
+ * c0 + c1 * k + c2 * k * (k - 1) / 2 after k iterations, with coefficients
+ * that only depend on what the slots held before the loop. The preheader
+ * then works out the number of iterations and the value of every slot read
+ * after the loop, and only goes on to the loop itself when it can't be sure
+ * of the count (the loop wouldn't run, or the count doesn't fit in an int).
+ * Arithmetic wraps around like the interpreters', so the result is the same
+ * as running the loop.
+ *
+ * Coefficients are terms: constants, what a slot held before the loop, or
+ * an operation on two terms. Equal terms share one id so each is only
+ * computed once.
+ */
+#define TERM_CONSTANT 0
+#define TERM_SLOT 1
+
+struct Term
+{
+    int kind;               // TERM_CONSTANT, TERM_SLOT or an ArithmeticOperatorType
+    int a;                  // value, slot or first operand
+    int b;                  // second operand
+};
+
+// c[0] + c[1] * k + c[2] * k * (k - 1) / 2, plus the value of slot header
+// when the iteration started unless header is -1
+struct Polynomial
+{
+    bool valid;
+    int header;
+    int c[3];
+};
+
+struct ClosedForm
+{
+    LoopInfo* info;
+    vector<Term> terms;
+    map<pair<int, pair<int, int> >, int> ids;
+    vector<int> slots;      // slot holding each term once computed, -1 before
+};
+
+static int term(ClosedForm& form, int kind, int a, int b)
+{
+    pair<int, pair<int, int> > key = make_pair(kind, make_pair(a, b));
+    map<pair<int, pair<int, int> >, int>::iterator it = form.ids.find(key);
+    if (it != form.ids.end())
+        return it->second;
+    Term t;
+    t.kind = kind;
+    t.a = a;
+    t.b = b;
+    form.terms.push_back(t);
+    form.slots.push_back(-1);
+    form.ids[key] = form.terms.size() - 1;
+    return form.terms.size() - 1;
+}
+
+static int constant_term(ClosedForm& form, int value)
+{
+    return term(form, TERM_CONSTANT, value, 0);
+}
+
+static bool is_constant_term(const ClosedForm& form, int t, int value)
+{
+    return form.terms[t].kind == TERM_CONSTANT && form.terms[t].a == value;
+}
+
+// What slot held before the loop
+static int slot_term(ClosedForm& form, int slot)
+{
+    if (is_constant_slot(*form.info, slot))
+        return constant_term(form, form.info->function->localMem[slot]);
+    return term(form, TERM_SLOT, slot, 0);
+}
+
+static int operation_term(ClosedForm& form, ArithmeticOperatorType op, int left, int right)
+{
+    const Term& l = form.terms[left];
+    const Term& r = form.terms[right];
+    int value;
+    if (l.kind == TERM_CONSTANT && r.kind == TERM_CONSTANT && fold_arithmetic(op, l.a, r.a, &value))
+        return constant_term(form, value);
+    if ((op == OPERATOR_PLUS || op == OPERATOR_MINUS) && is_constant_term(form, right, 0))
+        return left;
+    if (op == OPERATOR_PLUS && is_constant_term(form, left, 0))
+        return right;
+    if (op == OPERATOR_MINUS && left == right)
+        return constant_term(form, 0);
+    if (op == OPERATOR_MULT && (is_constant_term(form, left, 0) || is_constant_term(form, right, 0)))
+        return constant_term(form, 0);
+    if ((op == OPERATOR_MULT || op == OPERATOR_DIV) && is_constant_term(form, right, 1))
+        return left;
+    if (op == OPERATOR_MULT && is_constant_term(form, left, 1))
+        return right;
+    return term(form, op, left, right);
+}
+
+static Polynomial invalid_polynomial()
+{
+    Polynomial p;
+    p.valid = false;
+    p.header = -1;
+    p.c[0] = p.c[1] = p.c[2] = -1;
+    return p;
+}
+
+static Polynomial constant_polynomial(ClosedForm& form, int t)
+{
+    Polynomial p;
+    p.valid = true;
+    p.header = -1;
+    p.c[0] = t;
+    p.c[1] = p.c[2] = constant_term(form, 0);
+    return p;
+}
+
+static bool is_degree_zero(const ClosedForm& form, const Polynomial& p)
+{
+    return p.header == -1 && is_constant_term(form, p.c[1], 0) && is_constant_term(form, p.c[2], 0);
+}
+
+static Polynomial combine(ClosedForm& form, ArithmeticOperatorType op, const Polynomial& x, const Polynomial& y)
+{
+    if (!x.valid || !y.valid)
+        return invalid_polynomial();
+
+    Polynomial p = x;
+    switch (op)
+    {
+        case OPERATOR_NONE:
+            return x;
+        case OPERATOR_PLUS:
+        case OPERATOR_MINUS:
+            if (y.header != -1 && (x.header != -1 || op == OPERATOR_MINUS))
+                return invalid_polynomial();
+            if (x.header == -1)
+                p.header = y.header;
+            for (int i = 0; i < 3; i++)
+                p.c[i] = operation_term(form, op, x.c[i], y.c[i]);
+            return p;
+        case OPERATOR_MULT:
+            if (x.header != -1 || y.header != -1)
+                return invalid_polynomial();
+            if (is_degree_zero(form, y))
+            {
+                for (int i = 0; i < 3; i++)
+                    p.c[i] = operation_term(form, op, x.c[i], y.c[0]);
+                return p;
+            }
+            if (is_degree_zero(form, x))
+                return combine(form, op, y, x);
+            return invalid_polynomial();
+        case OPERATOR_DIV:
+            if (!is_degree_zero(form, x) || !is_degree_zero(form, y))
+                return invalid_polynomial();
+            p.c[0] = operation_term(form, op, x.c[0], y.c[0]);
+            return p;
+    }
+    return invalid_polynomial();
+}
+
+// Value of p after k iterations, k a term
+static int evaluate(ClosedForm& form, const Polynomial& p, int k)
+{
+    int value = operation_term(form, OPERATOR_PLUS, p.c[0], operation_term(form, OPERATOR_MULT, p.c[1], k));
+    if (is_constant_term(form, p.c[2], 0))
+        return value;
+
+    // k * (k - 1) / 2 as h * (2 * k - 1 - 2 * h) with h = k / 2, which
+    // doesn't lose the bit the product would push out
+    int one = constant_term(form, 1);
+    int h = operation_term(form, OPERATOR_DIV, k, constant_term(form, 2));
+    int twice_k = operation_term(form, OPERATOR_PLUS, k, k);
+    int twice_h = operation_term(form, OPERATOR_PLUS, h, h);
+    int odd = operation_term(form, OPERATOR_MINUS, operation_term(form, OPERATOR_MINUS, twice_k, one), twice_h);
+    int triangle = operation_term(form, OPERATOR_MULT, h, odd);
+    return operation_term(form, OPERATOR_PLUS, value, operation_term(form, OPERATOR_MULT, p.c[2], triangle));
+}
+
+// Runs the ASSIGNs of one iteration over values, the slots at its start
+static void run_iteration(ClosedForm& form, const vector<InstructionNode*>& body, vector<Polynomial>& values)
+{
+    for (int i = 0; i < body.size(); i++)
+    {
+        struct InstructionNode* node = body[i];
+        if (node->type != ASSIGN)
+            continue;
+        Polynomial left = values[node->assign_inst.operand1_index];
+        Polynomial right = node->assign_inst.op == OPERATOR_NONE ? left : values[node->assign_inst.operand2_index];
+        values[node->assign_inst.left_hand_side_index] = combine(form, node->assign_inst.op, left, right);
+    }
+}
+
+// Slot holding t, computed in the preheader if needed
+static int emit_term(ClosedForm& form, int t)
+{
+    if (form.slots[t] != -1)
+        return form.slots[t];
+    LoopInfo& info = *form.info;
+    Term term = form.terms[t];
+    int slot;
+    if (term.kind == TERM_CONSTANT)
+        slot = constant_slot(info.function, term.a);
+    else if (term.kind == TERM_SLOT)
+        slot = term.a;
+    else
+    {
+        int left = emit_term(form, term.a);
+        int right = emit_term(form, term.b);
+        slot = temp_slot(info.function);
+        info.preheader.push_back(new_assign(slot, left, (ArithmeticOperatorType) term.kind, right));
+    }
+    add_slot(info, slot);
+    form.slots[t] = slot;
+    return slot;
+}
+
+// Goes on to the loop itself unless left condition right holds
+static void emit_guard(ClosedForm& form, ConditionalOperatorType condition, int left, int right)
+{
+    LoopInfo& info = *form.info;
+    struct InstructionNode* node = new InstructionNode;
+    node->type = CJMP;
+    node->cjmp_inst.condition_op = condition;
+    node->cjmp_inst.operand1_index = emit_term(form, left);
+    node->cjmp_inst.operand2_index = emit_term(form, right);
+    node->cjmp_inst.target = info.cfg.blocks[info.loop.header].nodes[0];
+    node->next = NULL;
+    info.preheader.push_back(node);
+}
+
+// The ASSIGNs, NOOPs and JMP run between the header and the back edge, in
+// order, false when the loop has any other shape
+static bool straight_body(const LoopInfo& info, vector<InstructionNode*>& body)
+{
+    const ControlFlowGraph& cfg = info.cfg;
+    const BasicBlock& header = cfg.blocks[info.loop.header];
+    if (header.nodes.size() != 1 || header.nodes[0]->type != CJMP || header.successors.size() != 2)
+        return false;
+    int exit = header.successors[1];
+    if (exit == EXIT_BLOCK || info.loop.blocks[exit])
+        return false;
+
+    int count = 1;
+    for (int b = header.successors[0]; b != info.loop.header; b = cfg.blocks[b].successors[0])
+    {
+        if (b == EXIT_BLOCK || !info.loop.blocks[b] || count == info.loop.size)
+            return false;
+        const BasicBlock& block = cfg.blocks[b];
+        if (block.successors.size() != 1)
+            return false;
+        for (int i = 0; i < block.nodes.size(); i++)
+        {
+            struct InstructionNode* node = block.nodes[i];
+            if (node->type != ASSIGN && node->type != NOOP && node->type != JMP)
+                return false;
+            // The preheader leaves out what isn't read after the loop, so
+            // a division that could trap has to run in the loop
+            if (node->type == ASSIGN && node->assign_inst.op == OPERATOR_DIV)
+            {
+                int divisor = node->assign_inst.operand2_index;
+                if (!is_constant_slot(info, divisor))
+                    return false;
+                int value = info.function->localMem[divisor];
+                if (value == 0 || value == -1)
+                    return false;
+            }
+        }
+        body.insert(body.end(), block.nodes.begin(), block.nodes.end());
+        count++;
+    }
+    return count == info.loop.size;
+}
+
+static bool evaluate_closed_form(LoopInfo& info)
+{
+    vector<InstructionNode*> body;
+    if (!straight_body(info, body))
+        return false;
+
+    ClosedForm form;
+    form.info = &info;
+    int frame_size = info.defs.size();
+
+    // Every slot read at the start of an iteration and written in it has to
+    // grow by a polynomial of degree 1 at most, once the ones it depends on
+    // are known
+    vector<Polynomial> start(frame_size);
+    vector<bool> unknown(frame_size, false);
+    int unknown_count = 0;
+    for (int slot = 0; slot < frame_size; slot++)
+    {
+        if (info.defs[slot] == 0)
+            start[slot] = constant_polynomial(form, slot_term(form, slot));
+        else if (info.live_at_header[slot])
+        {
+            start[slot] = constant_polynomial(form, constant_term(form, 0));
+            start[slot].header = slot;
+            unknown[slot] = true;
+            unknown_count++;
+        }
+        else
+            start[slot] = invalid_polynomial();
+    }
+
+    vector<Polynomial> end;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        end = start;
+        run_iteration(form, body, end);
+        for (int slot = 0; slot < frame_size; slot++)
+        {
+            const Polynomial& p = end[slot];
+            if (!unknown[slot] || !p.valid || p.header != slot || !is_constant_term(form, p.c[2], 0))
+                continue;
+            start[slot].header = -1;
+            start[slot].c[0] = slot_term(form, slot);
+            start[slot].c[1] = p.c[0];
+            start[slot].c[2] = p.c[1];
+            unknown[slot] = false;
+            unknown_count--;
+            changed = true;
+        }
+    }
+    if (unknown_count > 0)
+        return false;
+    for (int slot = 0; slot < frame_size; slot++)
+    {
+        if (info.defs[slot] > 0 && info.live_at_exits[slot] && !info.live_at_header[slot] &&
+            (!end[slot].valid || end[slot].header != -1))
+            return false;
+    }
+
+    // The condition compares an induction variable stepped by a constant
+    // with something the loop doesn't change
+    struct InstructionNode* header = info.cfg.blocks[info.loop.header].nodes[0];
+    ConditionalOperatorType condition = header->cjmp_inst.condition_op;
+    Polynomial variable = start[header->cjmp_inst.operand1_index];
+    Polynomial bound = start[header->cjmp_inst.operand2_index];
+    if (!variable.valid || !bound.valid)
+        return false;
+    if (is_degree_zero(form, variable))
+    {
+        swap(variable, bound);
+        if (condition != CONDITION_NOTEQUAL)
+            condition = condition == CONDITION_LESS ? CONDITION_GREATER : CONDITION_LESS;
+    }
+    const Term& step_term = form.terms[variable.c[1]];
+    if (!is_degree_zero(form, bound) || !is_constant_term(form, variable.c[2], 0) || step_term.kind != TERM_CONSTANT)
+        return false;
+    int step = step_term.a;
+    if (condition == CONDITION_NOTEQUAL && step != 1 && step != -1)
+        return false;
+    if ((condition == CONDITION_LESS && step <= 0) || (condition == CONDITION_GREATER && step >= 0))
+        return false;
+
+    // Number of iterations: (distance - 1) / step + 1, with the distance to
+    // the bound positive and the last step not wrapping around past it
+    bool up = step > 0;
+    int first = variable.c[0];
+    int limit = bound.c[0];
+    int zero = constant_term(form, 0);
+    int one = constant_term(form, 1);
+    if (condition != CONDITION_NOTEQUAL)
+        emit_guard(form, condition, first, limit);
+    int distance = up ? operation_term(form, OPERATOR_MINUS, limit, first)
+                      : operation_term(form, OPERATOR_MINUS, first, limit);
+    emit_guard(form, CONDITION_GREATER, distance, zero);
+    int magnitude = constant_term(form, up ? step : (int) (0u - (unsigned) step));
+    int trips = distance;
+    if (!is_constant_term(form, magnitude, 1))
+    {
+        trips = operation_term(form, OPERATOR_PLUS, one,
+            operation_term(form, OPERATOR_DIV, operation_term(form, OPERATOR_MINUS, distance, one), magnitude));
+        int last = evaluate(form, variable, trips);
+        if (up)
+            emit_guard(form, CONDITION_GREATER, last, operation_term(form, OPERATOR_MINUS, limit, one));
+        else
+            emit_guard(form, CONDITION_LESS, last, operation_term(form, OPERATOR_PLUS, limit, one));
+    }
+
+    // Slots read at the start of an iteration are left as the next one
+    // would start, the others as the last one ended
+    int k = trips;
+    int last_k = operation_term(form, OPERATOR_MINUS, k, one);
+    vector<int> results(frame_size, -1);
+    for (int slot = 0; slot < frame_size; slot++)
+    {
+        if (info.defs[slot] == 0 || !info.live_at_exits[slot])
+            continue;
+        if (info.live_at_header[slot])
+            results[slot] = emit_term(form, evaluate(form, start[slot], k));
+        else
+            results[slot] = emit_term(form, evaluate(form, end[slot], last_k));
+    }
+    for (int slot = 0; slot < frame_size; slot++)
+    {
+        int result = results[slot];
+        if (result == -1 || result == slot || result >= info.defs.size() || info.defs[result] == 0)
+            continue;
+        results[slot] = temp_slot(info.function);
+        add_slot(info, results[slot]);
+        info.preheader.push_back(new_assign(results[slot], result, OPERATOR_NONE, result));
+    }
+    for (int slot = 0; slot < frame_size; slot++)
+    {
+        if (results[slot] != -1 && results[slot] != slot)
+            info.preheader.push_back(new_assign(slot, results[slot], OPERATOR_NONE, results[slot]));
+    }
+
+    struct InstructionNode* jump = new InstructionNode;
+    jump->type = JMP;
+    jump->jmp_inst.target = header->cjmp_inst.target;
+    jump->next = NULL;
+    info.preheader.push_back(jump);
+    return true;
+}
+
+// Sends every edge that enters the loop from outside through the preheader
+static void insert_preheader(LoopInfo& info)
+{
+    struct InstructionNode* header = info.cfg.blocks[info.loop.header].nodes[0];
+    for (int i = 0; i + 1 < info.preheader.size(); i++)
+        info.preheader[i]->next = info.preheader[i+1];
+    info.preheader.back()->next = header;
+    struct InstructionNode* first = info.preheader[0];
+
+    for (int b = 0; b < info.cfg.blocks.size(); b++)
+    {
+        if (info.loop.blocks[b])
+            continue;
+        const vector<InstructionNode*>& nodes = info.cfg.blocks[b].nodes;
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            struct InstructionNode* node = nodes[i];
+            if (node->type != JMP && node->next == header)
+                node->next = first;
+            if (node->type == CJMP && node->cjmp_inst.target == header)
+                node->cjmp_inst.target = first;
+            else if (node->type == JMP && node->jmp_inst.target == header)
+                node->jmp_inst.target = first;
+            else if (node->type == SWITCHJMP)
+            {
+                for (int c = 0; c < node->switch_inst.cases->size(); c++)
+                {
+                    if (node->switch_inst.cases->at(c).target == header)
+                        node->switch_inst.cases->at(c).target = first;
+                }
+            }
+        }
+    }
+    if (info.function->body == header)
+        info.function->body = first;
+}
+
+// Optimizes the innermost loop whose header isn't in done, false when there is none
+static bool optimize_next_loop(struct Function* function, set<InstructionNode*>& done)
+{
+    LoopInfo info;
+    info.function = function;
+    build_cfg(function->body, info.cfg);
+    vector<int> idom;
+    compute_dominators(info.cfg, idom);
+    vector<Loop> loops;
+    find_loops(info.cfg, idom, loops);
+
+    int best = -1;
+    for (int i = 0; i < loops.size(); i++)
+    {
+        if (done.count(info.cfg.blocks[loops[i].header].nodes[0]))
+            continue;
+        if (best == -1 || loops[i].size < loops[best].size)
+            best = i;
+    }
+    if (best == -1)
+        return false;
+    info.loop = loops[best];
+    done.insert(info.cfg.blocks[info.loop.header].nodes[0]);
+
+    // The return value is read after a function ends
+    int frame_size = function->localMem.size();
+    vector<bool> live_at_exit(frame_size, false);
+    if (function != main_function)
+        live_at_exit[0] = true;
+    vector<vector<bool> > live_in;
+    compute_liveness(info.cfg, live_at_exit, live_in);
+
+    info.live_at_header = live_in[info.loop.header];
+    info.live_at_exits.assign(frame_size, false);
+    info.defs.assign(frame_size, 0);
+    info.defs_in_body.assign(frame_size, 0);
+    for (int b = 0; b < info.cfg.blocks.size(); b++)
+    {
+        const BasicBlock& block = info.cfg.blocks[b];
+        for (int i = 0; i < block.nodes.size(); i++)
+        {
+            int def = node_def(block.nodes[i]);
+            if (def == -1)
+                continue;
+            info.defs_in_body[def]++;
+            if (info.loop.blocks[b])
+                info.defs[def]++;
+        }
+        if (!info.loop.blocks[b])
+            continue;
+        info.nodes.insert(block.nodes.begin(), block.nodes.end());
+        for (int i = 0; i < block.successors.size(); i++)
+        {
+            int s = block.successors[i];
+            if (s != EXIT_BLOCK && info.loop.blocks[s])
+                continue;
+            const vector<bool>& live = s == EXIT_BLOCK ? live_at_exit : live_in[s];
+            for (int slot = 0; slot < frame_size; slot++)
+                info.live_at_exits[slot] = info.live_at_exits[slot] || live[slot];
+        }
+    }
+
+    if (evaluate_closed_form(info))
+    {
+        insert_preheader(info);
+        return true;
+    }
+    hoist_invariants(info);
+    reduce_strength(info);
+    if (!info.preheader.empty())
+        insert_preheader(info);
+    return true;
+}
+
+void optimize_loops(struct Function* function)
+{
+    set<InstructionNode*> done;
+    while (optimize_next_loop(function, done))
+        ;
+}
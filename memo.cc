@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "memo.h"
+
+using namespace std;
+
+#define MEMO_SETS   1024        // must be a power of two
+#define MEMO_WAYS   4
+
+bool memoization = false;
+
+struct MemoCache
+{
+    string name;
+    int arity;
+    vector<int> keys;                   // arity ints per entry
+    vector<int> values;
+    vector<unsigned long long> used;    // last use of each entry, 0 when empty
+    unsigned long long clock;
+    long long hits;
+    long long misses;
+    long long evictions;
+};
+
+static vector<MemoCache*> caches;
+static vector<int> pending;             // arguments of the calls that missed, innermost last
+
+struct MemoCache* new_memo_cache(const char* name, int arity)
+{
+    MemoCache* cache = new MemoCache;
+    cache->name = name;
+    cache->arity = arity;
+    cache->keys.resize(MEMO_SETS * MEMO_WAYS * arity);
+    cache->values.resize(MEMO_SETS * MEMO_WAYS);
+    cache->used.resize(MEMO_SETS * MEMO_WAYS, 0);
+    cache->clock = 0;
+    cache->hits = cache->misses = cache->evictions = 0;
+    caches.push_back(cache);
+    return cache;
+}
+
+static int find_set(struct MemoCache* cache, const int* arguments)
+{
+    unsigned hash = 2166136261u;
+    for (int i = 0; i < cache->arity; i++)
+        hash = (hash ^ (unsigned) arguments[i]) * 16777619u;
+    hash ^= hash >> 15;
+    return (hash & (MEMO_SETS - 1)) * MEMO_WAYS;
+}
+
+// Entry holding arguments, or -1
+static int find_entry(struct MemoCache* cache, int set, const int* arguments)
+{
+    for (int entry = set; entry < set + MEMO_WAYS; entry++)
+    {
+        if (cache->used[entry] == 0)
+            continue;
+        const int* key = &cache->keys[entry * cache->arity];
+        int i = 0;
+        while (i < cache->arity && key[i] == arguments[i])
+            i++;
+        if (i == cache->arity)
+            return entry;
+    }
+    return -1;
+}
+
+bool memo_lookup(struct MemoCache* cache, const int* arguments, int* value)
+{
+    int entry = find_entry(cache, find_set(cache, arguments), arguments);
+    if (entry != -1)
+    {
+        cache->used[entry] = ++cache->clock;
+        *value = cache->values[entry];
+        cache->hits++;
+        return true;
+    }
+
+    cache->misses++;
+    pending.insert(pending.end(), arguments, arguments + cache->arity);
+    return false;
+}
+
+void memo_store(struct MemoCache* cache, int value)
+{
+    const int* arguments = pending.data() + (pending.size() - cache->arity);
+    int set = find_set(cache, arguments);
+
+    // A nested call with the same arguments may have stored it already
+    int entry = find_entry(cache, set, arguments);
+    if (entry == -1)
+    {
+        entry = set;
+        for (int way = set + 1; way < set + MEMO_WAYS; way++)
+        {
+            if (cache->used[way] < cache->used[entry])
+                entry = way;
+        }
+        if (cache->used[entry] != 0)
+            cache->evictions++;
+        for (int i = 0; i < cache->arity; i++)
+            cache->keys[entry * cache->arity + i] = arguments[i];
+    }
+    cache->values[entry] = value;
+    cache->used[entry] = ++cache->clock;
+    pending.resize(pending.size() - cache->arity);
+}
+
+void print_memo_statistics(FILE* out)
+{
+    for (int i = 0; i < caches.size(); i++)
+    {
+        fprintf(out, "%s: %lld hits, %lld misses, %lld evictions\n", caches[i]->name.c_str(),
+                caches[i]->hits, caches[i]->misses, caches[i]->evictions);
+    }
+}
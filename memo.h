@@ -0,0 +1,27 @@
+#ifndef __MEMO__H__
+#define __MEMO__H__
+
+#include <cstdio>
+
+/*
+ * Result caches for pure functions (see classify_pure_functions). A cache
+ * maps the arguments of a call to the value it returned. It has a fixed
+ * number of entries, grouped in small sets that are replaced in least
+ * recently used order.
+ *
+ * A call asks memo_lookup first. On a miss the arguments are remembered
+ * until the call returns and memo_store records its value, so calls can
+ * nest any number of levels deep.
+ */
+struct MemoCache;
+
+extern bool memoization;            // set by main, read when lowering calls
+
+struct MemoCache* new_memo_cache(const char* name, int arity);
+
+bool memo_lookup(struct MemoCache* cache, const int* arguments, int* value);
+void memo_store(struct MemoCache* cache, int value);
+
+void print_memo_statistics(FILE* out);
+
+#endif  //__MEMO__H__
@@ -0,0 +1,524 @@
+#include <climits>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "compiler.h"
+#include "optimizer.h"
+#include "cfg.h"
+#include "profile.h"
+
+using namespace std;
+
+void collect_nodes(struct InstructionNode* body, vector<struct InstructionNode*>& nodes)
+{
+    set<InstructionNode*> seen;
+    vector<InstructionNode*> work;
+    work.push_back(body);
+    while (!work.empty())
+    {
+        struct InstructionNode* node = work.back();
+        work.pop_back();
+        while (node != NULL && seen.insert(node).second)
+        {
+            nodes.push_back(node);
+            if (node->type == CJMP)
+                work.push_back(node->cjmp_inst.target);
+            else if (node->type == JMP)
+                work.push_back(node->jmp_inst.target);
+            else if (node->type == SWITCHJMP)
+            {
+                for (int i = 0; i < node->switch_inst.cases->size(); i++)
+                    work.push_back(node->switch_inst.cases->at(i).target);
+            }
+            node = node->next;
+        }
+    }
+}
+
+int constant_slot(struct Function* function, int value)
+{
+    // Literals are never assigned to, so their slots can be shared
+    map<int, int>::iterator known = function->constant_slots.find(value);
+    if (known != function->constant_slots.end())
+        return known->second;
+    function->localvarNames.push_back(to_string(value));
+    function->localMem.push_back(value);
+    int slot = function->localMem.size() - 1;
+    function->constant_slots[value] = slot;
+    return slot;
+}
+
+int temp_slot(struct Function* function)
+{
+    function->localvarNames.push_back("");
+    function->localMem.push_back(0);
+    return function->localMem.size() - 1;
+}
+
+/*
+ * Constant propagation works on one value per slot: UNKNOWN until some path
+ * reaches it, then either a single CONSTANT or VARYING. Only the edges of a
+ * CJMP that can be taken with the values known at it are followed, so a
+ * branch that is never taken doesn't spoil the values after it.
+ */
+enum { UNKNOWN, CONSTANT, VARYING };
+
+struct SlotValue
+{
+    int kind;
+    int value;
+};
+
+typedef vector<SlotValue> SlotValues;
+
+static bool is_constant(const SlotValues& values, int slot)
+{
+    return values[slot].kind == CONSTANT;
+}
+
+bool fold_arithmetic(ArithmeticOperatorType op, int left, int right, int* result)
+{
+    switch (op)
+    {
+        case OPERATOR_NONE:
+            *result = left;
+            return true;
+        case OPERATOR_PLUS:
+            *result = (int) ((unsigned) left + (unsigned) right);
+            return true;
+        case OPERATOR_MINUS:
+            *result = (int) ((unsigned) left - (unsigned) right);
+            return true;
+        case OPERATOR_MULT:
+            *result = (int) ((unsigned) left * (unsigned) right);
+            return true;
+        case OPERATOR_DIV:
+            if (right == 0 || (left == INT_MIN && right == -1))
+                return false;
+            *result = left / right;
+            return true;
+    }
+    return false;
+}
+
+static bool fold_condition(ConditionalOperatorType condition_op, int left, int right)
+{
+    switch (condition_op)
+    {
+        case CONDITION_GREATER:
+            return left > right;
+        case CONDITION_LESS:
+            return left < right;
+        case CONDITION_NOTEQUAL:
+            return left != right;
+    }
+    return false;
+}
+
+static void transfer(struct InstructionNode* node, SlotValues& values)
+{
+    if (node->type == ASSIGN)
+    {
+        SlotValue& lhs = values[node->assign_inst.left_hand_side_index];
+        int left = node->assign_inst.operand1_index;
+        int right = node->assign_inst.op == OPERATOR_NONE ? left : node->assign_inst.operand2_index;
+        int result;
+        if (is_constant(values, left) && is_constant(values, right) &&
+            fold_arithmetic(node->assign_inst.op, values[left].value, values[right].value, &result))
+        {
+            lhs.kind = CONSTANT;
+            lhs.value = result;
+        }
+        else
+            lhs.kind = VARYING;
+    }
+    else if (node->type == FUNCTION)
+        values[node->function_inst.result_index].kind = VARYING;
+}
+
+// Position of the case of a SWITCHJMP taken for value, -1 for none
+static int find_case(struct InstructionNode* node, int value)
+{
+    for (int i = 0; i < node->switch_inst.cases->size(); i++)
+    {
+        if (node->switch_inst.cases->at(i).value == value)
+            return i;
+    }
+    return -1;
+}
+
+// Successor blocks of block that can be taken with values at its end
+static void feasible_successors(const BasicBlock& block, const SlotValues& values, vector<int>& successors)
+{
+    struct InstructionNode* last = block.nodes.back();
+    if (last->type == SWITCHJMP && is_constant(values, last->switch_inst.operand_index))
+        successors.push_back(block.successors[find_case(last, values[last->switch_inst.operand_index].value) + 1]);
+    else if (last->type == CJMP && is_constant(values, last->cjmp_inst.operand1_index) &&
+        is_constant(values, last->cjmp_inst.operand2_index))
+    {
+        bool holds = fold_condition(last->cjmp_inst.condition_op, values[last->cjmp_inst.operand1_index].value,
+                                    values[last->cjmp_inst.operand2_index].value);
+        successors.push_back(block.successors[holds ? 0 : 1]);
+    }
+    else
+        successors = block.successors;
+}
+
+// Merges incoming into values, true when values changed
+static bool merge_values(SlotValues& values, const SlotValues& incoming)
+{
+    bool changed = false;
+    for (int i = 0; i < values.size(); i++)
+    {
+        if (values[i].kind == VARYING || incoming[i].kind == UNKNOWN)
+            continue;
+        if (values[i].kind == UNKNOWN)
+            values[i] = incoming[i];
+        else if (incoming[i].kind == VARYING || incoming[i].value != values[i].value)
+            values[i].kind = VARYING;
+        else
+            continue;
+        changed = true;
+    }
+    return changed;
+}
+
+static void rewrite(struct Function* function, struct InstructionNode* node, const SlotValues& values)
+{
+    if (node->type == ASSIGN)
+    {
+        int left = node->assign_inst.operand1_index;
+        int right = node->assign_inst.op == OPERATOR_NONE ? left : node->assign_inst.operand2_index;
+        int result;
+        if (is_constant(values, left) && is_constant(values, right) &&
+            fold_arithmetic(node->assign_inst.op, values[left].value, values[right].value, &result))
+        {
+            node->assign_inst.op = OPERATOR_NONE;
+            node->assign_inst.operand1_index = constant_slot(function, result);
+        }
+    }
+    else if (node->type == CJMP)
+    {
+        int left = node->cjmp_inst.operand1_index;
+        int right = node->cjmp_inst.operand2_index;
+        if (!is_constant(values, left) || !is_constant(values, right))
+            return;
+        if (fold_condition(node->cjmp_inst.condition_op, values[left].value, values[right].value))
+            node->type = NOOP;
+        else
+        {
+            // The statements the condition guarded are left behind
+            struct InstructionNode* target = node->cjmp_inst.target;
+            node->type = JMP;
+            node->jmp_inst.target = target;
+            node->next = NULL;
+        }
+    }
+    else if (node->type == SWITCHJMP)
+    {
+        if (!is_constant(values, node->switch_inst.operand_index))
+            return;
+        int i = find_case(node, values[node->switch_inst.operand_index].value);
+        if (i == -1)
+            node->type = NOOP;
+        else
+        {
+            struct InstructionNode* target = node->switch_inst.cases->at(i).target;
+            node->type = JMP;
+            node->jmp_inst.target = target;
+            node->next = NULL;
+        }
+    }
+    else if (node->type == PRINTIN && is_constant(values, node->print_inst.var_index))
+        node->print_inst.var_index = constant_slot(function, values[node->print_inst.var_index].value);
+}
+
+/*
+ * Folds every ASSIGN whose operands are known at that point into a copy of
+ * a constant slot, and turns every CJMP or SWITCHJMP whose outcome is known
+ * into a NOOP or a JMP, which drops the statements that can't run.
+ */
+void propagate_constants(struct Function* function)
+{
+    ControlFlowGraph cfg;
+    build_cfg(function->body, cfg);
+    if (cfg.blocks.empty())
+        return;
+
+    // Arguments can be anything, every other slot starts from the template
+    SlotValues entry(function->localMem.size());
+    for (int i = 0; i < entry.size(); i++)
+    {
+        entry[i].kind = i >= 1 && i <= function->parameter_count ? VARYING : CONSTANT;
+        entry[i].value = function->localMem[i];
+    }
+
+    vector<SlotValues> in(cfg.blocks.size());
+    vector<bool> reached(cfg.blocks.size(), false);
+    vector<int> work;
+    in[0] = entry;
+    reached[0] = true;
+    work.push_back(0);
+    while (!work.empty())
+    {
+        int b = work.back();
+        work.pop_back();
+        SlotValues values = in[b];
+        for (int i = 0; i < cfg.blocks[b].nodes.size(); i++)
+            transfer(cfg.blocks[b].nodes[i], values);
+
+        vector<int> successors;
+        feasible_successors(cfg.blocks[b], values, successors);
+        for (int i = 0; i < successors.size(); i++)
+        {
+            int s = successors[i];
+            if (s == EXIT_BLOCK)
+                continue;
+            if (!reached[s])
+            {
+                reached[s] = true;
+                in[s] = values;
+                work.push_back(s);
+            }
+            else if (merge_values(in[s], values))
+                work.push_back(s);
+        }
+    }
+
+    for (int b = 0; b < cfg.blocks.size(); b++)
+    {
+        if (!reached[b])
+            continue;
+        SlotValues values = in[b];
+        for (int i = 0; i < cfg.blocks[b].nodes.size(); i++)
+        {
+            rewrite(function, cfg.blocks[b].nodes[i], values);
+
+            // Slots added by constant_slot hold their value everywhere
+            for (int slot = values.size(); slot < function->localMem.size(); slot++)
+            {
+                SlotValue added = { CONSTANT, function->localMem[slot] };
+                values.push_back(added);
+            }
+            transfer(cfg.blocks[b].nodes[i], values);
+        }
+    }
+}
+
+// First node past the NOOPs and JMPs starting at node. A NOOP that ends the
+// body is kept, so jumps always have somewhere to go. Every node walked over
+// is remembered in resolved with where it leads, so each run of NOOPs and
+// JMPs is only walked once; a node maps to NULL while it is being walked,
+// which is how a run that jumps back into itself is found.
+static struct InstructionNode* skip_jumps(struct InstructionNode* node, map<InstructionNode*, InstructionNode*>& resolved)
+{
+    vector<InstructionNode*> path;
+    while (node != NULL)
+    {
+        map<InstructionNode*, InstructionNode*>::iterator known = resolved.find(node);
+        if (known != resolved.end())
+        {
+            if (known->second != NULL)
+                node = known->second;
+            break;
+        }
+        struct InstructionNode* next;
+        if (node->type == NOOP)
+            next = node->next;
+        else if (node->type == JMP)
+            next = node->jmp_inst.target;
+        else
+            break;
+        if (next == NULL)
+            break;
+        resolved[node] = NULL;
+        path.push_back(node);
+        node = next;
+    }
+    for (int i = 0; i < path.size(); i++)
+        resolved[path[i]] = node;
+    return node;
+}
+
+/*
+ * A SWITCH whose profile has one case matching at least half of the times
+ * it ran first checks for that case with a CJMP, which is cheaper than the
+ * table or the search the SWITCH becomes. The case stays in the SWITCH.
+ */
+void test_frequent_cases(struct Function* function)
+{
+    vector<InstructionNode*> nodes;
+    collect_nodes(function->body, nodes);
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        struct InstructionNode* node = nodes[i];
+        const NodeProfile* profile = node_profile(node);
+        if (node->type != SWITCHJMP || profile == NULL || profile->cases.empty())
+            continue;
+
+        map<int, long long>::const_iterator frequent = profile->cases.begin();
+        for (map<int, long long>::const_iterator it = profile->cases.begin(); it != profile->cases.end(); it++)
+        {
+            if (it->second > frequent->second)
+                frequent = it;
+        }
+        int c = find_case(node, frequent->first);
+        if (c == -1 || 2 * frequent->second < profile->executed)
+            continue;
+
+        // The SWITCH moves to a copy, since other nodes point to this one
+        struct InstructionNode* rest = new InstructionNode(*node);
+        copy_profile(node, rest);
+        struct InstructionNode* target = node->switch_inst.cases->at(c).target;
+        int operand = node->switch_inst.operand_index;
+        node->type = CJMP;
+        node->cjmp_inst.condition_op = CONDITION_NOTEQUAL;
+        node->cjmp_inst.operand1_index = operand;
+        node->cjmp_inst.operand2_index = constant_slot(function, frequent->first);
+        node->cjmp_inst.target = target;
+        node->next = rest;
+    }
+}
+
+/*
+ * Every IF, WHILE, FOR and SWITCH ends in a NOOP the parser adds as a jump
+ * target, and nested statements chain them up with JMPs in between. Pointing
+ * every next and every jump past them leaves nothing to dispatch there.
+ */
+void thread_jumps(struct Function* function)
+{
+    vector<InstructionNode*> nodes;
+    collect_nodes(function->body, nodes);
+    map<InstructionNode*, InstructionNode*> resolved;
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        struct InstructionNode* node = nodes[i];
+        if (node->type == CJMP)
+            node->cjmp_inst.target = skip_jumps(node->cjmp_inst.target, resolved);
+        else if (node->type == JMP)
+            node->jmp_inst.target = skip_jumps(node->jmp_inst.target, resolved);
+        else if (node->type == SWITCHJMP)
+        {
+            for (int c = 0; c < node->switch_inst.cases->size(); c++)
+                node->switch_inst.cases->at(c).target = skip_jumps(node->switch_inst.cases->at(c).target, resolved);
+        }
+        if (node->type != JMP)
+            node->next = skip_jumps(node->next, resolved);
+    }
+    function->body = skip_jumps(function->body, resolved);
+}
+
+// True when nothing but NOOPs and JMPs run between node and the end of the body
+static bool reaches_end(struct InstructionNode* node)
+{
+    set<InstructionNode*> seen;
+    while (node != NULL)
+    {
+        if (!seen.insert(node).second)
+            return false;
+        if (node->type == NOOP)
+            node = node->next;
+        else if (node->type == JMP)
+            node = node->jmp_inst.target;
+        else
+            return false;
+    }
+    return true;
+}
+
+/*
+ * A call is in tail position when it is followed by "Foo = <result>;" (slot
+ * 0 is the return value) and then by the end of the function. Such a call
+ * becomes a TAILCALL, which reuses the frame of the function making it and
+ * jumps to the body of the callee, so the callee returns straight to the
+ * original caller.
+ */
+void eliminate_tail_calls()
+{
+    for (int f = 0; f < declared_functions.size(); f++)
+    {
+        vector<InstructionNode*> nodes;
+        collect_nodes(declared_functions[f]->body, nodes);
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            struct InstructionNode* call = nodes[i];
+            struct InstructionNode* assign = call->next;
+            if (call->type != FUNCTION || assign == NULL || assign->type != ASSIGN)
+                continue;
+            if (assign->assign_inst.op != OPERATOR_NONE ||
+                assign->assign_inst.left_hand_side_index != 0 ||
+                assign->assign_inst.operand1_index != call->function_inst.result_index)
+                continue;
+            if (!reaches_end(assign->next))
+                continue;
+
+            call->type = TAILCALL;
+            call->next = NULL;
+        }
+    }
+}
+
+/*
+ * Functions can only touch their own frame, so one that never prints,
+ * directly or through the functions it calls, computes its return value
+ * from its arguments alone. Recursive calls are assumed pure until shown
+ * otherwise.
+ */
+void classify_pure_functions()
+{
+    vector<vector<InstructionNode*> > bodies(declared_functions.size());
+    for (int f = 0; f < declared_functions.size(); f++)
+    {
+        collect_nodes(declared_functions[f]->body, bodies[f]);
+        declared_functions[f]->pure = true;
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int f = 0; f < declared_functions.size(); f++)
+        {
+            if (!declared_functions[f]->pure)
+                continue;
+            for (int i = 0; i < bodies[f].size(); i++)
+            {
+                struct InstructionNode* node = bodies[f][i];
+                if (node->type == PRINTIN ||
+                    ((node->type == FUNCTION || node->type == TAILCALL) && !node->function_inst.function->pure))
+                {
+                    declared_functions[f]->pure = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void optimize_program()
+{
+    inline_functions();
+    propagate_constants(main_function);
+    for (int f = 0; f < declared_functions.size(); f++)
+        propagate_constants(declared_functions[f]);
+    optimize_ssa(main_function);
+    for (int f = 0; f < declared_functions.size(); f++)
+        optimize_ssa(declared_functions[f]);
+    optimize_loops(main_function);
+    for (int f = 0; f < declared_functions.size(); f++)
+        optimize_loops(declared_functions[f]);
+    if (has_profile())
+    {
+        test_frequent_cases(main_function);
+        for (int f = 0; f < declared_functions.size(); f++)
+            test_frequent_cases(declared_functions[f]);
+    }
+    thread_jumps(main_function);
+    for (int f = 0; f < declared_functions.size(); f++)
+        thread_jumps(declared_functions[f]);
+    eliminate_tail_calls();
+}
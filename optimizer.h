@@ -0,0 +1,43 @@
+#ifndef __OPTIMIZER__H__
+#define __OPTIMIZER__H__
+
+#include <vector>
+
+#include "compiler.h"
+
+using namespace std;
+
+/*
+ * Passes over the intermediate representation, run after parsing and
+ * before the program is lowered or emitted. They work on main and on every
+ * function in declared_functions.
+ */
+void optimize_program();
+
+// Statements that inlining may still add, set from the command line
+extern int inline_budget;
+
+void inline_functions();
+void propagate_constants(struct Function* function);
+// Value numbering, copy propagation and dead code elimination over SSA form
+void optimize_ssa(struct Function* function);
+void optimize_loops(struct Function* function);
+void test_frequent_cases(struct Function* function);
+void thread_jumps(struct Function* function);
+void eliminate_tail_calls();
+void classify_pure_functions();
+
+// Appends every node reachable from body, through next or a jump, to nodes
+void collect_nodes(struct InstructionNode* body, vector<struct InstructionNode*>& nodes);
+
+// Index of a slot of the frame of function that holds value and is never
+// written, added to the frame when there is none yet
+int constant_slot(struct Function* function, int value);
+
+// Folds like the interpreters compute, false when the result isn't defined
+bool fold_arithmetic(ArithmeticOperatorType op, int left, int right, int* result);
+
+// Index of a new unnamed slot of the frame of function
+int temp_slot(struct Function* function);
+
+#endif  //__OPTIMIZER__H__
@@ -43,39 +43,42 @@ void Parser::expect(TokenType token)
 void Parser::addToMem(Token t, int value)
 {
     /* Dealt with variable section */
-    if (location(t.lexeme) == -1)
+    if (location(t.symbol) == -1)
     {
-        localvarNames.push_back(t.lexeme);
+        localvarNames.push_back(string(t.lexeme));
         localMem.push_back(value);
+        bindSlot(t.symbol, localMem.size() - 1);
     }
 }
 
+// Adds an unnamed slot, which location() never finds, and returns its index
+int Parser::addTempToMem()
+{
+    localvarNames.push_back("");
+    localMem.push_back(0);
+    return localMem.size() - 1;
+}
+
+// Sets the variables of main aside while the functions are parsed
 void Parser::addToGlobalMem()
 {
-    for (int i = 0; i < localMem.size(); i++)
-    {
-        int location = stack_pointer + frame_pointer;
-        if (location < 1000)
-        {
-            varNames[location] = localvarNames[i];
-            mem[location] = localMem[i];
-            stack_pointer++;
-        }
-        else
-        {
-            debug("MEMORY ERROR !!!\nRan out of memory\n");
-            exit(EXIT_FAILURE);
-        }
-    }
+    globalvarNames = localvarNames;
+    globalMem = localMem;
 }
 
 void Parser::getGlobalMem()
 {
     clearLocalMem();
-    for (int i = frame_pointer; i < stack_pointer; i++)
+    for (int i = 0; i < globalMem.size(); i++)
     {
-        localMem.push_back(mem[frame_pointer + i]);
-        localvarNames.push_back(varNames[frame_pointer + i]);
+        localMem.push_back(globalMem[i]);
+        localvarNames.push_back(globalvarNames[i]);
+        if (!localvarNames.back().empty())
+        {
+            int symbol = lexer.symbols.Intern(localvarNames.back());
+            if (location(symbol) == -1)
+                bindSlot(symbol, localMem.size() - 1);
+        }
     }
 }
 
@@ -83,22 +86,42 @@ void Parser::clearLocalMem()
 {
     localMem.clear();
     localvarNames.clear();
+    constantSlots.clear();
+    for (int i = 0; i < frameSymbols.size(); i++)
+        slotOfSymbol[frameSymbols[i]] = -1;
+    frameSymbols.clear();
 }
 
-int Parser::location(string name)
+// Slot of the frame named symbol, -1 for none
+int Parser::location(int symbol)
 {
-    for (int i = 0; i < localvarNames.size(); i++)
+    return symbol < slotOfSymbol.size() ? slotOfSymbol[symbol] : -1;
+}
+
+// Slot of the variable t names, which has to be declared in this frame
+int Parser::declaredLocation(Token t)
+{
+    int slot = location(t.symbol);
+    if (slot == -1)
     {
-        if (!localvarNames[i].empty())
-        {
-            if (localvarNames[i] == name)
-            {
-                return i;
-            }
-        }
+        debug("Variable Doesn't Exist on Line %d\n", t.line_no);
+        exit(EXIT_FAILURE);
     }
+    return slot;
+}
 
-    return -1;
+void Parser::bindSlot(int symbol, int slot)
+{
+    if (symbol >= slotOfSymbol.size())
+        slotOfSymbol.resize(lexer.symbols.Count(), -1);
+    slotOfSymbol[symbol] = slot;
+    frameSymbols.push_back(symbol);
+}
+
+// First function declared with the name symbol, NULL for none
+Function* Parser::findFunction(int symbol)
+{
+    return symbol < functionOfSymbol.size() ? functionOfSymbol[symbol] : NULL;
 }
 
 /* Parser */
@@ -107,11 +130,9 @@ struct InstructionNode* Parser::parse_program()
 {
     struct InstructionNode* head;
     parse_var_section();
-    isMain = false;
     parse_func_decl_list();
-    isMain = true;
     getGlobalMem();
-    head = parse_body();
+    head = parse_body(NULL);
     return head;
 }
 
@@ -128,47 +149,44 @@ void Parser::parse_var_section()
     else syntax_error(SEMICOLON, t);
 }
 
-vector<string> Parser::parse_id_list(bool write)
+// Declares the ids when write is set, otherwise returns the slots they name
+vector<int> Parser::parse_id_list(bool write)
 {
-    string id;
-    vector<string> ids;
+    vector<int> slots;
 
     Token t = lexer.peek(1);
-    if (t.token_type == ID)
+    while (true)
     {
+        if (t.token_type != ID)
+            syntax_error(ID, t);
         expect(ID);
 
         if (write) addToMem(t, 0);
-        else id = t.lexeme;
+        else slots.push_back(declaredLocation(t));
 
         t = lexer.peek(1);
-        if (t.token_type == COMMA)
-        {
-            expect(COMMA);
-            if (write) parse_id_list(true);
-            else ids = parse_id_list(false);
-        }
+        if (t.token_type != COMMA)
+            break;
+        expect(COMMA);
+        t = lexer.peek(1);
     }
-    else syntax_error(ID, t);
-    ids.insert(ids.begin(), id);
-    return ids;
+    return slots;
 }
 
 void Parser::parse_func_decl_list()
 {
-    parse_func_decl();
-    clearLocalMem();
-
-    Token t = lexer.peek(1);
-    if (t.token_type == ID)
+    do
     {
-        parse_func_decl_list();
+        parse_func_decl();
+        clearLocalMem();
     }
+    while (lexer.peek(1).token_type == ID);
 }
 
 struct Function* Parser::parse_func_decl()
 {
     Function* function = new Function;
+    function->pure = false;
     functions.push_back(function);
 
     Token t = lexer.peek(1);
@@ -177,6 +195,11 @@ struct Function* Parser::parse_func_decl()
         expect(ID);
 
         function->name = t.lexeme;
+        if (findFunction(t.symbol) == NULL)
+        {
+            functionOfSymbol.resize(max((int) functionOfSymbol.size(), t.symbol + 1), NULL);
+            functionOfSymbol[t.symbol] = function;
+        }
         addToMem(t, 0);
 
         t = lexer.peek(1);
@@ -188,6 +211,7 @@ struct Function* Parser::parse_func_decl()
             if (t.token_type == ID)
             {
                 parse_id_list(true);
+                function->parameter_count = localMem.size() - 1;
 
                 t = lexer.peek(1);
                 if (t.token_type == RPAREN)
@@ -197,6 +221,7 @@ struct Function* Parser::parse_func_decl()
                     function->body = parse_function_body();
                     function->localvarNames = localvarNames;
                     function->localMem = localMem;
+                    function->constant_slots = constantSlots;
                 }
                 else syntax_error(RPAREN, t);
             }
@@ -224,7 +249,7 @@ struct InstructionNode* Parser::parse_function_body()
         {
             expect(SEMICOLON);
 
-            node = parse_stmt_list();
+            node = parse_stmt_list(NULL);
 
             t = lexer.peek(1);
             if (t.token_type == RBRACE)
@@ -239,7 +264,9 @@ struct InstructionNode* Parser::parse_function_body()
     return node;
 }
 
-struct InstructionNode* Parser::parse_body()
+// Sets *tail, unless tail is NULL, to the last node of the list returned,
+// and so do the parse_*_stmt functions
+struct InstructionNode* Parser::parse_body(struct InstructionNode** tail)
 {
     struct InstructionNode* node;
 
@@ -248,12 +275,7 @@ struct InstructionNode* Parser::parse_body()
     {
         expect(LBRACE);
 
-        node = parse_stmt_list();
-        if (isMain)
-        {
-            stack_pointer = 0;
-            addToGlobalMem();
-        }
+        node = parse_stmt_list(tail);
         t = lexer.peek(1);
         if (t.token_type == RBRACE)
         {
@@ -268,38 +290,36 @@ struct InstructionNode* Parser::parse_body()
     return node;
 }
 
-struct InstructionNode* Parser::parse_stmt_list()
+struct InstructionNode* Parser::parse_stmt_list(struct InstructionNode** tail)
 {
-    struct InstructionNode* node = parse_stmt();
+    struct InstructionNode* last;
+    struct InstructionNode* node = parse_stmt(&last);
 
     Token t = lexer.peek(1);
-    if (t.token_type == ID     ||
-        t.token_type == PRINT ||
-        t.token_type == WHILE  ||
-        t.token_type == IF     ||
-        t.token_type == SWITCH ||
-        t.token_type == FOR)
-    {
-        struct InstructionNode* iterator = node;
-        while (iterator->next != nullptr)
-        {
-            iterator = iterator->next;
-        }
-        iterator->next = parse_stmt_list();
+    while (t.token_type == ID     ||
+           t.token_type == PRINT ||
+           t.token_type == WHILE  ||
+           t.token_type == IF     ||
+           t.token_type == SWITCH ||
+           t.token_type == FOR)
+    {
+        last->next = parse_stmt(&last);
+        t = lexer.peek(1);
     }
+    if (tail != NULL) *tail = last;
     return node;
 }
 
-struct InstructionNode* Parser::parse_stmt()
+struct InstructionNode* Parser::parse_stmt(struct InstructionNode** tail)
 {
     struct InstructionNode* node;
     Token t = lexer.peek(1);
-    if (t.token_type == ID)          node = parse_assign_stmt();
-    else if (t.token_type == PRINT)  node = parse_print_stmt();
-    else if (t.token_type == WHILE)  node = parse_while_stmt();
-    else if (t.token_type == IF)     node = parse_if_stmt();
-    else if (t.token_type == SWITCH) node = parse_switch_stmt();
-    else if (t.token_type == FOR)    node = parse_for_stmt();
+    if (t.token_type == ID)          node = parse_assign_stmt(tail);
+    else if (t.token_type == PRINT)  node = parse_print_stmt(tail);
+    else if (t.token_type == WHILE)  node = parse_while_stmt(tail);
+    else if (t.token_type == IF)     node = parse_if_stmt(tail);
+    else if (t.token_type == SWITCH) node = parse_switch_stmt(tail);
+    else if (t.token_type == FOR)    node = parse_for_stmt(tail);
     else
     {
         debug("SYNTAX ERROR !!!\nInvalid statement on Line %d\n", t.line_no);
@@ -308,11 +328,12 @@ struct InstructionNode* Parser::parse_stmt()
     return node;
 }
 
-struct InstructionNode* Parser::parse_print_stmt()
+struct InstructionNode* Parser::parse_print_stmt(struct InstructionNode** tail)
 {
     struct InstructionNode* node = new InstructionNode;
     node->type = PRINTIN;
     node->next = nullptr;
+    *tail = node;
 
     Token t = lexer.peek(1);
     if (t.token_type == PRINT)
@@ -323,7 +344,7 @@ struct InstructionNode* Parser::parse_print_stmt()
         if (t.token_type == ID)
         {
             expect(ID);
-            node->print_inst.var_index = location(t.lexeme);
+            node->print_inst.var_index = declaredLocation(t);
 
             t = lexer.peek(1);
             if (t.token_type == SEMICOLON)
@@ -338,11 +359,12 @@ struct InstructionNode* Parser::parse_print_stmt()
     return node;
 }
 
-struct InstructionNode* Parser::parse_assign_stmt()
+struct InstructionNode* Parser::parse_assign_stmt(struct InstructionNode** tail)
 {
     struct InstructionNode* node = new InstructionNode;
     node->type = ASSIGN;
     node->next = nullptr;
+    *tail = node;
 
     InstructionNode* funCall = nullptr;
 
@@ -351,7 +373,7 @@ struct InstructionNode* Parser::parse_assign_stmt()
     {
         expect(ID);
 
-        node->assign_inst.left_hand_side_index = location(t.lexeme);
+        node->assign_inst.left_hand_side_index = declaredLocation(t);
 
         t = lexer.peek(1);
         if (t.token_type == EQUAL)
@@ -369,7 +391,8 @@ struct InstructionNode* Parser::parse_assign_stmt()
             {
                 funCall = parse_function_call();
                 node->assign_inst.op = OPERATOR_NONE;
-                node->assign_inst.operand1_index = localMem.size();
+                node->assign_inst.operand1_index = addTempToMem();
+                funCall->function_inst.result_index = node->assign_inst.operand1_index;
                 funCall->next = node;
             }
             else
@@ -398,13 +421,16 @@ int Parser::parse_primary()
     if (t.token_type == ID)
     {
         expect(ID);
-        return location(t.lexeme);
+        return declaredLocation(t);
     }
     else if (t.token_type == NUM)
     {
         expect(NUM);
-        addToMem(t, stoi(t.lexeme));
-        return location(t.lexeme);
+        int value = stoi(string(t.lexeme));
+        addToMem(t, value);
+        int slot = location(t.symbol);
+        constantSlots.insert(make_pair(value, slot));
+        return slot;
     }
     else
     {
@@ -431,18 +457,8 @@ struct InstructionNode* Parser::parse_function_call()
     {
         expect(ID);
 
-        bool success = false;
-        for (int i = 0; i < functions.size(); i++)
-        {
-            if (functions[i]->name == t.lexeme)
-            {
-                node->function_inst.function = functions[i];
-                success = true;
-                break;
-            }
-        }
-
-        if (!success)
+        node->function_inst.function = findFunction(t.symbol);
+        if (node->function_inst.function == NULL)
         {
             debug("Function Doesn't Exist on Line %d", t.line_no);
             exit(EXIT_FAILURE);
@@ -453,18 +469,13 @@ struct InstructionNode* Parser::parse_function_call()
         {
             expect(LPAREN);
 
-            vector<string> parameters = parse_id_list(false);
+            vector<int> arguments = parse_id_list(false);
 
             t = lexer.peek(1);
             if (t.token_type == RPAREN)
             {
                 expect(RPAREN);
-                vector<int>* values = new vector<int>();
-                for (int i = 0; i < parameters.size(); i++)
-                {
-                    values->push_back(location(parameters[i]));
-                }
-                node->function_inst.operators = values;
+                node->function_inst.operators = new vector<int>(arguments);
             }
             else syntax_error(RPAREN, t);
         }
@@ -474,7 +485,7 @@ struct InstructionNode* Parser::parse_function_call()
     return node;
 }
 
-struct InstructionNode* Parser::parse_if_stmt()
+struct InstructionNode* Parser::parse_if_stmt(struct InstructionNode** tail)
 {
     struct InstructionNode* node = new InstructionNode;
     node->type = CJMP;
@@ -485,18 +496,14 @@ struct InstructionNode* Parser::parse_if_stmt()
     {
         expect(IF);
         parse_condition(node);
-        node->next = parse_body();
+        struct InstructionNode* body_tail;
+        node->next = parse_body(&body_tail);
 
         struct InstructionNode* noop = new InstructionNode;
         noop->type = NOOP;
         noop->next = nullptr;
-
-        struct InstructionNode* iterator = node;
-        while (iterator->next != nullptr)
-        {
-            iterator = iterator->next;
-        }
-        iterator->next = noop;
+        body_tail->next = noop;
+        *tail = noop;
 
         node->cjmp_inst.target = noop;
     }
@@ -504,7 +511,7 @@ struct InstructionNode* Parser::parse_if_stmt()
     return node;
 }
 
-struct InstructionNode* Parser::parse_while_stmt()
+struct InstructionNode* Parser::parse_while_stmt(struct InstructionNode** tail)
 {
     struct InstructionNode* node = new InstructionNode;
     node->type = CJMP;
@@ -515,24 +522,20 @@ struct InstructionNode* Parser::parse_while_stmt()
     {
         expect(WHILE);
         parse_condition(node);
-        node->next = parse_body();
+        struct InstructionNode* body_tail;
+        node->next = parse_body(&body_tail);
 
         struct InstructionNode* jmp = new InstructionNode;
         jmp->type = JMP;
         jmp->next = nullptr;
         jmp->jmp_inst.target = node;
-
-        struct InstructionNode* iterator = node;
-        while (iterator->next != nullptr)
-        {
-            iterator = iterator->next;
-        }
-        iterator->next = jmp;
+        body_tail->next = jmp;
 
         struct InstructionNode* noop = new InstructionNode;
         noop->type = NOOP;
         noop->next = nullptr;
-        iterator->next->next = noop;
+        jmp->next = noop;
+        *tail = noop;
 
         node->cjmp_inst.target = noop;
     }
@@ -540,7 +543,7 @@ struct InstructionNode* Parser::parse_while_stmt()
     return node;
 }
 
-struct InstructionNode* Parser::parse_for_stmt()
+struct InstructionNode* Parser::parse_for_stmt(struct InstructionNode** tail)
 {
     struct InstructionNode* node;
 
@@ -553,47 +556,45 @@ struct InstructionNode* Parser::parse_for_stmt()
         if (t.token_type == LPAREN)
         {
             expect(LPAREN);
-            node = parse_assign_stmt();
+            struct InstructionNode* assign1_tail;
+            node = parse_assign_stmt(&assign1_tail);
 
             struct InstructionNode* condition = new InstructionNode;
             condition->type = CJMP;
             condition->next = nullptr;
             parse_condition(condition);
-            node->next = condition;
+            assign1_tail->next = condition;
 
             t = lexer.peek(1);
             if (t.token_type == SEMICOLON)
             {
                 expect(SEMICOLON);
 
-                struct InstructionNode* assign2 = parse_assign_stmt();
+                struct InstructionNode* assign2_tail;
+                struct InstructionNode* assign2 = parse_assign_stmt(&assign2_tail);
 
                 t = lexer.peek(1);
                 if (t.token_type == RPAREN)
                 {
                     expect(RPAREN);
 
-                    condition->next = parse_body();
+                    struct InstructionNode* body_tail;
+                    condition->next = parse_body(&body_tail);
 
                     struct InstructionNode* jmp = new InstructionNode;
                     jmp->type = JMP;
                     jmp->next = nullptr;
                     jmp->jmp_inst.target = condition;
-
-                    struct InstructionNode* iterator = condition;
-                    while (iterator->next != nullptr)
-                    {
-                        iterator = iterator->next;
-                    }
-                    iterator->next = assign2;
-                    iterator->next->next = jmp;
+                    body_tail->next = assign2;
+                    assign2_tail->next = jmp;
 
                     struct InstructionNode* noop = new InstructionNode;
                     noop->type = NOOP;
                     noop->next = nullptr;
 
                     condition->cjmp_inst.target = noop;
-                    iterator->next->next->next = noop;
+                    jmp->next = noop;
+                    *tail = noop;
                 }
                 else syntax_error(RPAREN, t);
             }
@@ -605,7 +606,7 @@ struct InstructionNode* Parser::parse_for_stmt()
     return node;
 }
 
-struct InstructionNode* Parser::parse_switch_stmt()
+struct InstructionNode* Parser::parse_switch_stmt(struct InstructionNode** tail)
 {
     struct InstructionNode* node;
 
@@ -618,7 +619,11 @@ struct InstructionNode* Parser::parse_switch_stmt()
         if (t.token_type == ID)
         {
             expect(ID);
-            int operand1_index = location(t.lexeme);
+            node = new InstructionNode;
+            node->type = SWITCHJMP;
+            node->next = nullptr;
+            node->switch_inst.operand_index = declaredLocation(t);
+            node->switch_inst.cases = new vector<SwitchCase>;
 
             t = lexer.peek(1);
             if (t.token_type == LBRACE)
@@ -628,27 +633,16 @@ struct InstructionNode* Parser::parse_switch_stmt()
                 struct InstructionNode* label = new InstructionNode;
                 label->type = NOOP;
                 label->next = nullptr;
+                *tail = label;
 
-                node = parse_case_list(operand1_index, label);
-
-                struct InstructionNode* iterator = node;
-                while (iterator->next != nullptr)
-                {
-                    iterator = iterator->next;
-                }
+                parse_case_list(node, label);
 
                 t = lexer.peek(1);
                 if (t.token_type == DEFAULT)
                 {
-                    struct InstructionNode* defaultCase = parse_default_case();
-
-                    iterator->next = defaultCase;
-
-                    while (iterator->next != 0)
-                    {
-                        iterator = iterator->next;
-                    }
-                    iterator->next = label;
+                    struct InstructionNode* default_tail;
+                    node->next = parse_default_case(&default_tail);
+                    default_tail->next = label;
 
                     t = lexer.peek(1);
                     if (t.token_type == RBRACE)
@@ -660,7 +654,7 @@ struct InstructionNode* Parser::parse_switch_stmt()
                 else if (t.token_type == RBRACE)
                 {
                     expect(RBRACE);
-                    iterator->next = label;
+                    node->next = label;
                 }
                 else syntax_error(RBRACE, t);
             }
@@ -673,37 +667,33 @@ struct InstructionNode* Parser::parse_switch_stmt()
     return node;
 }
 
-struct InstructionNode* Parser::parse_case_list(int operand1_index, struct InstructionNode* label)
+void Parser::parse_case_list(struct InstructionNode* node, struct InstructionNode* label)
 {
-    struct InstructionNode* node = parse_case(operand1_index);
-
-    struct InstructionNode* iterator = node->cjmp_inst.target;
-    while (iterator->next != nullptr)
+    do
     {
-        iterator = iterator->next;
-    }
-
-    struct InstructionNode* jmp = new InstructionNode;
-    jmp->type = JMP;
-    jmp->next = nullptr;
-    jmp->jmp_inst.target = label;
-    iterator->next = jmp;
+        struct InstructionNode* case_tail;
+        struct SwitchCase c = parse_case(&case_tail);
 
-    Token t = lexer.peek(1);
-    if (t.token_type == CASE)
-    {
-        node->next = parse_case_list(operand1_index, label);
-    }
-    return node;
+        struct InstructionNode* jmp = new InstructionNode;
+        jmp->type = JMP;
+        jmp->next = nullptr;
+        jmp->jmp_inst.target = label;
+        case_tail->next = jmp;
+
+        // Only the first case with a given value can be reached
+        vector<SwitchCase>* cases = node->switch_inst.cases;
+        int i = 0;
+        while (i < cases->size() && cases->at(i).value != c.value)
+            i++;
+        if (i == cases->size())
+            cases->push_back(c);
+    }
+    while (lexer.peek(1).token_type == CASE);
 }
 
-struct InstructionNode* Parser::parse_case(int operand1_index)
+struct SwitchCase Parser::parse_case(struct InstructionNode** tail)
 {
-    struct InstructionNode* node = new InstructionNode;
-    node->type = CJMP;
-    node->next = nullptr;
-    node->cjmp_inst.operand1_index = operand1_index;
-    node->cjmp_inst.condition_op = CONDITION_NOTEQUAL;
+    struct SwitchCase c;
 
     Token t = lexer.peek(1);
     if (t.token_type == CASE)
@@ -714,25 +704,23 @@ struct InstructionNode* Parser::parse_case(int operand1_index)
         if (t.token_type == NUM)
         {
             expect(NUM);
-            addToMem(t, stoi(t.lexeme));
-            int operand2_index = location(t.lexeme);
-            node->cjmp_inst.operand2_index = operand2_index;
+            c.value = stoi(string(t.lexeme));
 
             t = lexer.peek(1);
             if (t.token_type == COLON)
             {
                 expect(COLON);
-                node->cjmp_inst.target = parse_body();
+                c.target = parse_body(tail);
             }
             else syntax_error(COLON, t);
         }
         else syntax_error(NUM, t);
     }
     else syntax_error(CASE, t);
-    return node;
+    return c;
 }
 
-struct InstructionNode* Parser::parse_default_case()
+struct InstructionNode* Parser::parse_default_case(struct InstructionNode** tail)
 {
     struct InstructionNode* node;
 
@@ -745,7 +733,7 @@ struct InstructionNode* Parser::parse_default_case()
         if (t.token_type == COLON)
         {
             expect(COLON);
-            node = parse_body();
+            node = parse_body(tail);
         }
         else syntax_error(COLON, t);
     }
@@ -816,8 +804,22 @@ ConditionalOperatorType Parser::parse_relop()
 }
 //-------------------------------------------------------------------------------------------------
 
+vector<struct Function*> declared_functions;
+struct Function* main_function;
+
 struct InstructionNode * parse_generate_intermediate_representation()
 {
     Parser parser;
-    return parser.parse_program();
+    struct InstructionNode* program = parser.parse_program();
+    declared_functions = parser.functions;
+
+    main_function = new Function;
+    main_function->name = "main";
+    main_function->localvarNames = parser.localvarNames;
+    main_function->localMem = parser.localMem;
+    main_function->constant_slots = parser.constantSlots;
+    main_function->body = program;
+    main_function->parameter_count = 0;
+    main_function->pure = false;
+    return program;
 }
\ No newline at end of file
@@ -20,44 +20,55 @@ class Parser
     public:
         vector<string> localvarNames;
         vector<int> localMem;
+        vector<string> globalvarNames;      // the variables of main
+        vector<int> globalMem;
+        map<int, int> constantSlots;        // slot holding each literal, by value
 
         LexicalAnalyzer lexer;
         vector<Function*> functions;
 
-        bool isMain;
+        // Slots of the frame being parsed and functions declared so far,
+        // indexed by the symbol of their name in lexer.symbols
+        vector<int> slotOfSymbol;           // -1 for none
+        vector<int> frameSymbols;           // symbols given a slot of this frame
+        vector<Function*> functionOfSymbol;
 
         void syntax_error(TokenType expected, Token actual);
 		void expect(TokenType token);
         void addToMem(Token t, int value);
+        int addTempToMem();
         void addToGlobalMem();
         void clearLocalMem();
         void getGlobalMem();
-        int location(string varName);
+        int location(int symbol);
+        int declaredLocation(Token t);
+        void bindSlot(int symbol, int slot);
+        Function* findFunction(int symbol);
 
         struct InstructionNode* parse_program();
         void parse_var_section();
-        vector<string> parse_id_list(bool write);
+        vector<int> parse_id_list(bool write);
         void parse_func_decl_list();
         struct Function* parse_func_decl();
         struct InstructionNode* parse_function_body();
-        struct InstructionNode* parse_body();
-        struct InstructionNode* parse_stmt_list();
-        struct InstructionNode* parse_stmt();
-        struct InstructionNode* parse_assign_stmt();
+        struct InstructionNode* parse_body(struct InstructionNode** tail);
+        struct InstructionNode* parse_stmt_list(struct InstructionNode** tail);
+        struct InstructionNode* parse_stmt(struct InstructionNode** tail);
+        struct InstructionNode* parse_assign_stmt(struct InstructionNode** tail);
         int parse_primary();
         void parse_expr(struct InstructionNode* node);
         struct InstructionNode* parse_function_call();
         ArithmeticOperatorType parse_op();
-        struct InstructionNode* parse_print_stmt();
-        struct InstructionNode* parse_while_stmt();
-        struct InstructionNode* parse_if_stmt();
+        struct InstructionNode* parse_print_stmt(struct InstructionNode** tail);
+        struct InstructionNode* parse_while_stmt(struct InstructionNode** tail);
+        struct InstructionNode* parse_if_stmt(struct InstructionNode** tail);
         void parse_condition(struct InstructionNode* node);
         ConditionalOperatorType parse_relop();
-        struct InstructionNode* parse_switch_stmt();
-        struct InstructionNode* parse_for_stmt();
-        struct InstructionNode* parse_case_list(int operand1_index, struct InstructionNode* label);
-        struct InstructionNode* parse_default_case();
-        struct InstructionNode* parse_case(int operand1_index);
+        struct InstructionNode* parse_switch_stmt(struct InstructionNode** tail);
+        struct InstructionNode* parse_for_stmt(struct InstructionNode** tail);
+        void parse_case_list(struct InstructionNode* node, struct InstructionNode* label);
+        struct InstructionNode* parse_default_case(struct InstructionNode** tail);
+        struct SwitchCase parse_case(struct InstructionNode** tail);
 };
 
 #endif  //__PARSER__H__
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "compiler.h"
+#include "bytecode.h"
+#include "optimizer.h"
+#include "profile.h"
+
+using namespace std;
+
+static map<InstructionNode*, int> ids;
+static vector<NodeProfile> profiles;        // by id, empty without a profile
+
+void number_nodes()
+{
+    vector<InstructionNode*> nodes;
+    collect_nodes(main_function->body, nodes);
+    for (int f = 0; f < declared_functions.size(); f++)
+        collect_nodes(declared_functions[f]->body, nodes);
+
+    ids.clear();
+    int count = 0;
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        if (ids.find(nodes[i]) == ids.end())
+            ids[nodes[i]] = count++;
+    }
+}
+
+static int node_id(struct InstructionNode* node)
+{
+    map<InstructionNode*, int>::iterator it = ids.find(node);
+    return it == ids.end() ? -1 : it->second;
+}
+
+/*
+ * The file starts with the number of nodes of the program, followed by one
+ * line per node that ran: its number, how often it ran, how often it jumped
+ * and how many cases follow, each as a value and a count.
+ */
+void write_profile(const char* path, struct BytecodeProgram* program, const struct ExecutionCounts& counts)
+{
+    vector<NodeProfile> totals(ids.size());
+    for (int i = 0; i < totals.size(); i++)
+        totals[i].executed = totals[i].taken = 0;
+    for (int i = 0; i < program->code.size(); i++)
+    {
+        int id = program->nodes[i] == NULL ? -1 : node_id(program->nodes[i]);
+        if (id == -1)
+            continue;
+        NodeProfile& profile = totals[id];
+        profile.executed += counts.executed[i];
+        profile.taken += counts.taken[i];
+
+        const Instruction& inst = program->code[i];
+        if (inst.opcode != OP_SWITCH_TABLE && inst.opcode != OP_SWITCH_SEARCH)
+            continue;
+        for (int entry = inst.b; entry < inst.b + inst.d; entry++)
+        {
+            if (counts.cases[entry] > 0)
+                profile.cases[program->case_values[entry]] += counts.cases[entry];
+        }
+    }
+
+    FILE* out = fopen(path, "w");
+    if (out == NULL)
+    {
+        debug("Error: can't write the profile to %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "%d\n", (int) totals.size());
+    for (int id = 0; id < totals.size(); id++)
+    {
+        const NodeProfile& profile = totals[id];
+        if (profile.executed == 0)
+            continue;
+        fprintf(out, "%d %lld %lld %d", id, profile.executed, profile.taken, (int) profile.cases.size());
+        for (map<int, long long>::const_iterator it = profile.cases.begin(); it != profile.cases.end(); it++)
+            fprintf(out, " %d %lld", it->first, it->second);
+        fprintf(out, "\n");
+    }
+    fclose(out);
+}
+
+void read_profile(const char* path)
+{
+    FILE* in = fopen(path, "r");
+    if (in == NULL)
+    {
+        debug("Error: can't read the profile from %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    int count;
+    bool valid = fscanf(in, "%d", &count) == 1 && count == ids.size();
+    vector<NodeProfile> loaded(valid ? count : 0);
+    for (int i = 0; i < loaded.size(); i++)
+        loaded[i].executed = loaded[i].taken = 0;
+    int id, cases;
+    long long executed, taken;
+    while (valid && fscanf(in, "%d %lld %lld %d", &id, &executed, &taken, &cases) == 4)
+    {
+        if (id < 0 || id >= count)
+        {
+            valid = false;
+            break;
+        }
+        loaded[id].executed = executed;
+        loaded[id].taken = taken;
+        for (int c = 0; c < cases && valid; c++)
+        {
+            int value;
+            long long matched;
+            valid = fscanf(in, "%d %lld", &value, &matched) == 2;
+            loaded[id].cases[value] = matched;
+        }
+    }
+    valid = valid && feof(in);
+    fclose(in);
+
+    if (!valid)
+    {
+        fprintf(stderr, "Warning: %s is not a profile of this program, ignoring it.\n", path);
+        return;
+    }
+    profiles.swap(loaded);
+}
+
+const struct NodeProfile* node_profile(struct InstructionNode* node)
+{
+    int id = node_id(node);
+    if (id == -1 || profiles.empty())
+        return NULL;
+    return &profiles[id];
+}
+
+void copy_profile(struct InstructionNode* node, struct InstructionNode* copy)
+{
+    int id = node_id(node);
+    if (id != -1)
+        ids[copy] = id;
+}
+
+bool has_profile()
+{
+    return !profiles.empty();
+}
+
+bool profile_prefers_target(struct InstructionNode* node)
+{
+    const NodeProfile* profile = node_profile(node);
+    return profile != NULL && 2 * profile->taken > profile->executed;
+}
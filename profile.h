@@ -0,0 +1,50 @@
+#ifndef __PROFILE__H__
+#define __PROFILE__H__
+
+#include <map>
+
+#include "compiler.h"
+#include "bytecode.h"
+
+using namespace std;
+
+/*
+ * Execution profiles. A training run (-profile-generate=FILE) runs the
+ * program as parsed on the switch interpreter, counting, and writes the
+ * counts to FILE. A later compile of the same program (-profile-use=FILE)
+ * reads them back to lay out branches, pick calls to inline and test the
+ * most frequent case of a SWITCH first.
+ *
+ * Counts belong to the nodes the parser produced, numbered by number_nodes
+ * in collect_nodes order, main first and then every function as declared,
+ * so the numbers are the same on every compile of the same program. Nodes
+ * the optimizer copies from one share its counts.
+ */
+struct NodeProfile
+{
+    long long executed;
+    long long taken;                    // CJMP: times it jumped to its target
+    map<int, long long> cases;          // SWITCHJMP: times each case value matched
+};
+
+// Numbers the nodes of main and every function; call right after parsing
+void number_nodes();
+
+void write_profile(const char* path, struct BytecodeProgram* program, const struct ExecutionCounts& counts);
+
+// Exits when path can't be read, ignores it with a warning when it was
+// written for another program
+void read_profile(const char* path);
+
+// Counts of node, NULL when there is no profile or node isn't in it
+const struct NodeProfile* node_profile(struct InstructionNode* node);
+
+// Makes copy share the counts of node
+void copy_profile(struct InstructionNode* node, struct InstructionNode* copy);
+
+bool has_profile();
+
+// The CJMP node went to its target more often than it fell through
+bool profile_prefers_target(struct InstructionNode* node);
+
+#endif  //__PROFILE__H__
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <vector>
+
+#include "compiler.h"
+#include "bytecode.h"
+#include "regalloc.h"
+
+using namespace std;
+
+static void instruction_uses(struct BytecodeProgram* program, const Instruction& inst, vector<int>& uses)
+{
+    switch (inst.opcode)
+    {
+        case OP_PRINT:
+        case OP_SWITCH_TABLE:
+        case OP_SWITCH_SEARCH:
+            uses.push_back(inst.a);
+            break;
+        case OP_ASSIGN_NONE:
+            uses.push_back(inst.b);
+            break;
+        case OP_ASSIGN_PLUS:
+        case OP_ASSIGN_MINUS:
+        case OP_ASSIGN_MULT:
+        case OP_ASSIGN_DIV:
+        case OP_CJMP_GREATER:
+        case OP_CJMP_LESS:
+        case OP_CJMP_NOTEQUAL:
+            uses.push_back(inst.b);
+            uses.push_back(inst.c);
+            break;
+        case OP_CALL:
+        case OP_CALL_MEMO:
+        case OP_TAILCALL:
+            for (int i = 0; i < inst.c; i++)
+                uses.push_back(program->arguments[inst.b + i]);
+            break;
+        case OP_RET:
+            uses.push_back(0);
+            break;
+        default:
+            break;
+    }
+}
+
+static int instruction_def(const Instruction& inst)
+{
+    if (inst.opcode >= OP_ASSIGN_NONE && inst.opcode <= OP_ASSIGN_DIV)
+        return inst.a;
+    if (inst.opcode == OP_CALL || inst.opcode == OP_CALL_MEMO)
+        return inst.a;
+    return -1;
+}
+
+static void instruction_successors(struct BytecodeProgram* program, int index, vector<int>& successors)
+{
+    const Instruction& inst = program->code[index];
+    switch (inst.opcode)
+    {
+        case OP_CJMP_GREATER:
+        case OP_CJMP_LESS:
+        case OP_CJMP_NOTEQUAL:
+            successors.push_back(inst.a);
+            successors.push_back(inst.target);
+            break;
+        case OP_JMP:
+            successors.push_back(inst.target);
+            break;
+        case OP_SWITCH_TABLE:
+        case OP_SWITCH_SEARCH:
+            successors.push_back(inst.target);
+            for (int i = 0; i < inst.d; i++)
+                successors.push_back(program->case_targets[inst.b + i]);
+            break;
+        case OP_TAILCALL:
+        case OP_RET:
+        case OP_HALT:
+            break;
+        default:
+            successors.push_back(index + 1);
+            break;
+    }
+}
+
+struct Interval
+{
+    int slot;
+    int start;
+    int end;
+};
+
+static bool by_start(const Interval& x, const Interval& y)
+{
+    return x.start < y.start;
+}
+
+void allocate_registers(struct BytecodeProgram* program, int begin, int end, int frame_size,
+                        int register_count, vector<int>& registers, vector<bool>& live_at_entry)
+{
+    int n = end - begin;
+    registers.assign(frame_size, -1);
+    live_at_entry.assign(frame_size, false);
+
+    // An instruction is in a loop when a jump from it or from further down
+    // goes back to it or further up
+    vector<int> loop_depth(n + 1, 0);
+    vector<vector<int> > successors(n);
+    for (int i = 0; i < n; i++)
+    {
+        instruction_successors(program, begin + i, successors[i]);
+        for (int s = 0; s < successors[i].size(); s++)
+        {
+            successors[i][s] -= begin;
+            if (successors[i][s] <= i)
+            {
+                loop_depth[successors[i][s]]++;
+                loop_depth[i + 1]--;
+            }
+        }
+    }
+
+    vector<int> candidate(frame_size, -1);
+    vector<int> slots;
+    int depth = 0;
+    for (int i = 0; i < n; i++)
+    {
+        depth += loop_depth[i];
+        if (depth == 0)
+            continue;
+        vector<int> accessed;
+        instruction_uses(program, program->code[begin + i], accessed);
+        accessed.push_back(instruction_def(program->code[begin + i]));
+        for (int k = 0; k < accessed.size(); k++)
+        {
+            int slot = accessed[k];
+            if (slot >= 0 && slot < frame_size && candidate[slot] == -1)
+            {
+                candidate[slot] = slots.size();
+                slots.push_back(slot);
+            }
+        }
+    }
+    if (slots.empty())
+        return;
+
+    // Liveness of the candidates at the start of every instruction
+    int count = slots.size();
+    vector<vector<int> > uses(n);
+    vector<int> defs(n, -1);
+    for (int i = 0; i < n; i++)
+    {
+        vector<int> read;
+        instruction_uses(program, program->code[begin + i], read);
+        for (int k = 0; k < read.size(); k++)
+        {
+            if (read[k] < frame_size && candidate[read[k]] != -1)
+                uses[i].push_back(candidate[read[k]]);
+        }
+        int def = instruction_def(program->code[begin + i]);
+        if (def != -1 && def < frame_size)
+            defs[i] = candidate[def];
+    }
+    vector<vector<bool> > live_in(n, vector<bool>(count, false));
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = n - 1; i >= 0; i--)
+        {
+            vector<bool> live(count, false);
+            for (int s = 0; s < successors[i].size(); s++)
+            {
+                for (int k = 0; k < count; k++)
+                {
+                    if (live_in[successors[i][s]][k])
+                        live[k] = true;
+                }
+            }
+            if (defs[i] != -1)
+                live[defs[i]] = false;
+            for (int k = 0; k < uses[i].size(); k++)
+                live[uses[i][k]] = true;
+            if (live != live_in[i])
+            {
+                live_in[i] = live;
+                changed = true;
+            }
+        }
+    }
+
+    vector<Interval> intervals(count);
+    for (int k = 0; k < count; k++)
+    {
+        intervals[k].slot = slots[k];
+        intervals[k].start = n;
+        intervals[k].end = -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        vector<int> touched = uses[i];
+        if (defs[i] != -1)
+            touched.push_back(defs[i]);
+        for (int k = 0; k < count; k++)
+        {
+            if (live_in[i][k])
+                touched.push_back(k);
+        }
+        for (int k = 0; k < touched.size(); k++)
+        {
+            Interval& interval = intervals[touched[k]];
+            interval.start = min(interval.start, i);
+            interval.end = max(interval.end, i);
+        }
+    }
+    for (int k = 0; k < count; k++)
+        live_at_entry[slots[k]] = n > 0 && live_in[0][k];
+    stable_sort(intervals.begin(), intervals.end(), by_start);
+
+    // Linear scan; when the registers run out, the interval that ends last
+    // goes back to the frame
+    vector<Interval> active;
+    vector<int> free_registers;
+    for (int r = register_count - 1; r >= 0; r--)
+        free_registers.push_back(r);
+    for (int k = 0; k < count; k++)
+    {
+        Interval& current = intervals[k];
+        for (int a = 0; a < active.size(); )
+        {
+            if (active[a].end < current.start)
+            {
+                free_registers.push_back(registers[active[a].slot]);
+                active.erase(active.begin() + a);
+            }
+            else
+                a++;
+        }
+
+        if (!free_registers.empty())
+        {
+            registers[current.slot] = free_registers.back();
+            free_registers.pop_back();
+            active.push_back(current);
+            continue;
+        }
+        int last = -1;
+        for (int a = 0; a < active.size(); a++)
+        {
+            if (last == -1 || active[a].end > active[last].end)
+                last = a;
+        }
+        if (last != -1 && active[last].end > current.end)
+        {
+            registers[current.slot] = registers[active[last].slot];
+            registers[active[last].slot] = -1;
+            active.erase(active.begin() + last);
+            active.push_back(current);
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef __REGALLOC__H__
+#define __REGALLOC__H__
+
+#include <vector>
+
+#include "bytecode.h"
+
+using namespace std;
+
+/*
+ * Linear scan allocation of the frame slots of one function of a bytecode
+ * program, code[begin..end), to register_count registers. Only slots read or
+ * written inside a loop are worth a register. A slot gets the whole of the
+ * range between its first and last live or accessed instruction, and slots
+ * whose ranges don't overlap may share a register.
+ *
+ * registers[slot] is the register given to slot, from 0 to
+ * register_count - 1, or -1 when it stays in the frame. live_at_entry[slot]
+ * tells whether the value the frame holds on entry is read.
+ */
+void allocate_registers(struct BytecodeProgram* program, int begin, int end, int frame_size,
+                        int register_count, vector<int>& registers, vector<bool>& live_at_entry);
+
+#endif  //__REGALLOC__H__
@@ -0,0 +1,123 @@
+#ifndef __RUNTIME__H__
+#define __RUNTIME__H__
+
+#include <algorithm>
+#include <cstring>
+
+#include "compiler.h"
+#include "bytecode.h"
+#include "memo.h"
+
+using namespace std;
+
+/*
+ * Calling convention shared by the interpreters, see FRAME_HEADER. Names of
+ * the slots are only needed by the parser, so only values are copied.
+ */
+
+// Sets up the frame of main at the bottom of the stack
+inline void enter_main(struct BytecodeProgram* program)
+{
+    ensure_stack(program->frame_size);
+    memcpy(mem, program->frame_template, program->frame_size * sizeof(int));
+    frame_pointer = 0;
+}
+
+// Sets up the frame of the function called by inst and returns the index of
+// its first instruction.
+inline int call_function(struct BytecodeProgram* program, const Instruction* inst, int return_pc)
+{
+    const BytecodeFunction& callee = program->functions[inst->target];
+    int callee_frame = frame_pointer + inst->d;
+    ensure_stack(callee_frame + callee.frame_size);
+
+    int* frame = mem + callee_frame;
+    memcpy(frame, callee.frame_template, callee.frame_size * sizeof(int));
+    for (int i = 0; i < inst->c; i++)
+    {
+        frame[i+1] = mem[frame_pointer + program->arguments[inst->b + i]];
+    }
+    frame[-2] = frame_pointer;
+    frame[-1] = return_pc;
+    frame_pointer = callee_frame;
+    return callee.entry;
+}
+
+// Same as call_function, but when the result cache of the callee already has
+// the value for these arguments the new frame is dropped and the call returns
+// right away.
+inline int call_function_memo(struct BytecodeProgram* program, const Instruction* inst, int return_pc)
+{
+    int entry = call_function(program, inst, return_pc);
+    int value;
+    if (memo_lookup(program->functions[inst->target].cache, mem + frame_pointer + 1, &value))
+    {
+        frame_pointer = mem[frame_pointer - 2];
+        mem[frame_pointer + inst->a] = value;
+        return return_pc;
+    }
+    return entry;
+}
+
+// Replaces the current frame with the frame of the function called by inst
+// and returns the index of its first instruction. The arguments go through
+// the free space past both frames since they are read from the frame that
+// gets overwritten.
+inline int tail_call_function(struct BytecodeProgram* program, const Instruction* inst)
+{
+    const BytecodeFunction& callee = program->functions[inst->target];
+    int scratch = inst->d > callee.frame_size ? inst->d : callee.frame_size;
+    ensure_stack(frame_pointer + scratch + inst->c);
+
+    int* frame = mem + frame_pointer;
+    for (int i = 0; i < inst->c; i++)
+    {
+        frame[scratch + i] = frame[program->arguments[inst->b + i]];
+    }
+    memcpy(frame, callee.frame_template, callee.frame_size * sizeof(int));
+    for (int i = 0; i < inst->c; i++)
+    {
+        frame[i+1] = frame[scratch + i];
+    }
+    return callee.entry;
+}
+
+// Pops the current frame, copies the return value to the slot the call asked
+// for and returns the index to continue at.
+inline int return_from_function(struct BytecodeProgram* program)
+{
+    int* frame = mem + frame_pointer;
+    int return_pc = frame[-1];
+    const Instruction& call = program->code[return_pc - 1];
+    frame_pointer = frame[-2];
+    mem[frame_pointer + call.a] = frame[0];
+    if (call.opcode == OP_CALL_MEMO)
+        memo_store(program->functions[call.target].cache, frame[0]);
+    return return_pc;
+}
+
+// Entry of case_targets the OP_SWITCH_* inst picks when its operand is
+// value, -1 for none
+inline int switch_entry(struct BytecodeProgram* program, const Instruction* inst, int value)
+{
+    if (inst->opcode == OP_SWITCH_TABLE)
+    {
+        unsigned entry = (unsigned) value - (unsigned) inst->c;
+        return entry < (unsigned) inst->d ? inst->b + entry : -1;
+    }
+
+    const int* values = program->case_values.data() + inst->b;
+    const int* found = lower_bound(values, values + inst->d, value);
+    if (found != values + inst->d && *found == value)
+        return inst->b + (found - values);
+    return -1;
+}
+
+// Index to continue at after the OP_SWITCH_* inst when its operand is value
+inline int switch_target(struct BytecodeProgram* program, const Instruction* inst, int value)
+{
+    int entry = switch_entry(program, inst, value);
+    return entry == -1 ? inst->target : program->case_targets[entry];
+}
+
+#endif  //__RUNTIME__H__
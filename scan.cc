@@ -0,0 +1,216 @@
+#include "scan.h"
+
+static inline bool is_space(unsigned char c)
+{
+    return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+static inline bool is_digit(unsigned char c)
+{
+    return (unsigned char) (c - '0') <= 9;
+}
+
+static inline bool is_identifier(unsigned char c)
+{
+    return is_digit(c) || (unsigned char) ((c | 0x20) - 'a') <= 'z' - 'a';
+}
+
+static const char* skip_space_scalar(const char* p, const char* limit, int* lines)
+{
+    while (p < limit && is_space(*p))
+    {
+        *lines += (*p == '\n');
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_identifier_scalar(const char* p, const char* limit)
+{
+    while (p < limit && is_identifier(*p))
+        p++;
+    return p;
+}
+
+static const char* skip_digits_scalar(const char* p, const char* limit)
+{
+    while (p < limit && is_digit(*p))
+        p++;
+    return p;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+/*
+ * There are no unsigned byte compares, so a <= x <= b is tested as
+ * min(max(x, a), b) == x. Folding in 0x20 makes upper case letters lower
+ * case and doesn't turn anything else into a letter. A block whose mask
+ * isn't all ones ends the run at its lowest zero bit.
+ */
+
+static inline __m128i in_range_sse2(__m128i x, char a, char b)
+{
+    return _mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(x, _mm_set1_epi8(a)), _mm_set1_epi8(b)), x);
+}
+
+static inline unsigned space_mask_sse2(__m128i x)
+{
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), in_range_sse2(x, '\t', '\r'));
+    return _mm_movemask_epi8(space);
+}
+
+static const char* skip_space_sse2(const char* p, const char* limit, int* lines)
+{
+    for (; limit - p >= 16; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*) p);
+        unsigned run = space_mask_sse2(x);
+        unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+        if (run != 0xFFFF)
+        {
+            int length = __builtin_ctz(~run);
+            *lines += __builtin_popcount(newlines & ((1u << length) - 1));
+            return p + length;
+        }
+        *lines += __builtin_popcount(newlines);
+    }
+    return skip_space_scalar(p, limit, lines);
+}
+
+static const char* skip_identifier_sse2(const char* p, const char* limit)
+{
+    for (; limit - p >= 16; p += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*) p);
+        __m128i letter = in_range_sse2(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+        unsigned run = _mm_movemask_epi8(_mm_or_si128(letter, in_range_sse2(x, '0', '9')));
+        if (run != 0xFFFF)
+            return p + __builtin_ctz(~run);
+    }
+    return skip_identifier_scalar(p, limit);
+}
+
+static const char* skip_digits_sse2(const char* p, const char* limit)
+{
+    for (; limit - p >= 16; p += 16)
+    {
+        unsigned run = _mm_movemask_epi8(in_range_sse2(_mm_loadu_si128((const __m128i*) p), '0', '9'));
+        if (run != 0xFFFF)
+            return p + __builtin_ctz(~run);
+    }
+    return skip_digits_scalar(p, limit);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i in_range_avx2(__m256i x, char a, char b)
+{
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_max_epu8(x, _mm256_set1_epi8(a)), _mm256_set1_epi8(b)), x);
+}
+
+AVX2 static const char* skip_space_avx2(const char* p, const char* limit, int* lines)
+{
+    for (; limit - p >= 32; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*) p);
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), in_range_avx2(x, '\t', '\r'));
+        unsigned run = _mm256_movemask_epi8(space);
+        unsigned newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+        if (run != 0xFFFFFFFF)
+        {
+            int length = __builtin_ctz(~run);
+            *lines += __builtin_popcount(newlines & ((1u << length) - 1));
+            return p + length;
+        }
+        *lines += __builtin_popcount(newlines);
+    }
+    return skip_space_sse2(p, limit, lines);
+}
+
+AVX2 static const char* skip_identifier_avx2(const char* p, const char* limit)
+{
+    for (; limit - p >= 32; p += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*) p);
+        __m256i letter = in_range_avx2(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z');
+        unsigned run = _mm256_movemask_epi8(_mm256_or_si256(letter, in_range_avx2(x, '0', '9')));
+        if (run != 0xFFFFFFFF)
+            return p + __builtin_ctz(~run);
+    }
+    return skip_identifier_sse2(p, limit);
+}
+
+AVX2 static const char* skip_digits_avx2(const char* p, const char* limit)
+{
+    for (; limit - p >= 32; p += 32)
+    {
+        unsigned run = _mm256_movemask_epi8(in_range_avx2(_mm256_loadu_si256((const __m256i*) p), '0', '9'));
+        if (run != 0xFFFFFFFF)
+            return p + __builtin_ctz(~run);
+    }
+    return skip_digits_sse2(p, limit);
+}
+
+static void select_kernels();
+
+static const char* skip_space_first(const char* p, const char* limit, int* lines);
+static const char* skip_identifier_first(const char* p, const char* limit);
+static const char* skip_digits_first(const char* p, const char* limit);
+
+// Start out at functions that pick the kernels for this CPU on the first call
+static const char* (*skip_space_kernel)(const char*, const char*, int*) = skip_space_first;
+static const char* (*skip_identifier_kernel)(const char*, const char*) = skip_identifier_first;
+static const char* (*skip_digits_kernel)(const char*, const char*) = skip_digits_first;
+
+// SSE2 is part of x86-64, AVX2 has to be asked for
+static void select_kernels()
+{
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    skip_space_kernel = avx2 ? skip_space_avx2 : skip_space_sse2;
+    skip_identifier_kernel = avx2 ? skip_identifier_avx2 : skip_identifier_sse2;
+    skip_digits_kernel = avx2 ? skip_digits_avx2 : skip_digits_sse2;
+}
+
+static const char* skip_space_first(const char* p, const char* limit, int* lines)
+{
+    select_kernels();
+    return skip_space_kernel(p, limit, lines);
+}
+
+static const char* skip_identifier_first(const char* p, const char* limit)
+{
+    select_kernels();
+    return skip_identifier_kernel(p, limit);
+}
+
+static const char* skip_digits_first(const char* p, const char* limit)
+{
+    select_kernels();
+    return skip_digits_kernel(p, limit);
+}
+
+#else
+
+static const char* (*const skip_space_kernel)(const char*, const char*, int*) = skip_space_scalar;
+static const char* (*const skip_identifier_kernel)(const char*, const char*) = skip_identifier_scalar;
+static const char* (*const skip_digits_kernel)(const char*, const char*) = skip_digits_scalar;
+
+#endif
+
+const char* skip_space(const char* p, const char* limit, int* lines)
+{
+    return skip_space_kernel(p, limit, lines);
+}
+
+const char* skip_identifier(const char* p, const char* limit)
+{
+    return skip_identifier_kernel(p, limit);
+}
+
+const char* skip_digits(const char* p, const char* limit)
+{
+    return skip_digits_kernel(p, limit);
+}
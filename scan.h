@@ -0,0 +1,20 @@
+#ifndef __SCAN__H__
+#define __SCAN__H__
+
+/*
+ * Kernels the lexer uses to get past runs of characters. Each returns the
+ * first character of [p, limit) that isn't part of the run. They test 32 or
+ * 16 characters at a time with AVX2 or SSE2, whichever the CPU has, and one
+ * at a time on other machines and for the last few characters.
+ */
+
+// Spaces as isspace sees them, adding the '\n's skipped to lines
+const char* skip_space(const char* p, const char* limit, int* lines);
+
+// Letters and digits
+const char* skip_identifier(const char* p, const char* limit);
+
+// Digits
+const char* skip_digits(const char* p, const char* limit);
+
+#endif  //__SCAN__H__
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "compiler.h"
+#include "optimizer.h"
+#include "ssa.h"
+
+using namespace std;
+
+/*
+ * Construction follows Cytron et al.: phis go on the iterated dominance
+ * frontier of the blocks writing a slot, and values are named by walking the
+ * dominator tree with a stack of values per slot. Phis are left out where the
+ * slot is dead, except when value numbering, which needs the top of the
+ * stack of a slot to be what the slot holds even where nothing reads it.
+ */
+
+static void dominance_frontiers(const ControlFlowGraph& cfg, const vector<int>& idom,
+                                vector<vector<int> >& frontier)
+{
+    frontier.assign(cfg.blocks.size(), vector<int>());
+    for (int b = 0; b < cfg.blocks.size(); b++)
+    {
+        const vector<int>& predecessors = cfg.blocks[b].predecessors;
+        if (predecessors.size() < 2)
+            continue;
+        for (int p = 0; p < predecessors.size(); p++)
+        {
+            int runner = predecessors[p];
+            while (runner != -1 && runner != idom[b])
+            {
+                if (frontier[runner].empty() || frontier[runner].back() != b)
+                    frontier[runner].push_back(b);
+                runner = idom[runner];
+            }
+        }
+    }
+}
+
+static int new_value(SsaFunction& ssa, SsaValueKind kind, int slot, int block, struct InstructionNode* node)
+{
+    SsaValue value;
+    value.kind = kind;
+    value.slot = slot;
+    value.block = block;
+    value.node = node;
+    ssa.values.push_back(value);
+    return ssa.values.size() - 1;
+}
+
+static void place_phis(SsaFunction& ssa, const vector<bool>& live_at_exit, bool pruned)
+{
+    const ControlFlowGraph& cfg = ssa.cfg;
+    int frame_size = live_at_exit.size();
+
+    vector<vector<int> > frontier;
+    dominance_frontiers(cfg, ssa.idom, frontier);
+    vector<vector<bool> > live_in;
+    compute_liveness(cfg, live_at_exit, live_in);
+
+    vector<vector<int> > def_blocks(frame_size);
+    for (int b = 0; b < cfg.blocks.size(); b++)
+    {
+        for (int i = 0; i < cfg.blocks[b].nodes.size(); i++)
+        {
+            int def = node_def(cfg.blocks[b].nodes[i]);
+            if (def != -1 && (def_blocks[def].empty() || def_blocks[def].back() != b))
+                def_blocks[def].push_back(b);
+        }
+    }
+
+    ssa.phis.assign(cfg.blocks.size(), vector<SsaPhi>());
+    vector<int> has_phi(cfg.blocks.size(), -1);
+    vector<int> queued(cfg.blocks.size(), -1);
+    for (int slot = 0; slot < frame_size; slot++)
+    {
+        vector<int> work = def_blocks[slot];
+        for (int i = 0; i < work.size(); i++)
+            queued[work[i]] = slot;
+        while (!work.empty())
+        {
+            int b = work.back();
+            work.pop_back();
+            for (int i = 0; i < frontier[b].size(); i++)
+            {
+                int d = frontier[b][i];
+                if (has_phi[d] == slot || (pruned && !live_in[d][slot]))
+                    continue;
+                SsaPhi phi;
+                phi.value = new_value(ssa, SSA_PHI, slot, d, NULL);
+                phi.operands.assign(cfg.blocks[d].predecessors.size(), -1);
+                ssa.phis[d].push_back(phi);
+                has_phi[d] = slot;
+                if (queued[d] != slot)
+                {
+                    queued[d] = slot;
+                    work.push_back(d);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Value numbering done while values are named. Every value has a leader,
+ * the first value known to be equal to it. An ASSIGN computing what a
+ * dominating ASSIGN already computed becomes a copy of it, and a read of a
+ * value is moved to the slot of its leader, as long as that slot still holds
+ * the leader at that point.
+ */
+struct ValueNumbering
+{
+    vector<int> leader;
+    map<pair<int, pair<int, int> >, int> available;
+    vector<pair<pair<int, pair<int, int> >, int> > undo;    // entry and what it replaced, -1 for nothing
+};
+
+struct Renaming
+{
+    SsaFunction* ssa;
+    vector<vector<int> > stacks;        // values of each slot, innermost last
+    ValueNumbering* numbering;          // NULL when only building
+};
+
+static int current(Renaming& renaming, int slot)
+{
+    return renaming.stacks[slot].back();
+}
+
+static int leader(Renaming& renaming, int value)
+{
+    ValueNumbering* numbering = renaming.numbering;
+    while (numbering->leader.size() < renaming.ssa->values.size())
+        numbering->leader.push_back(numbering->leader.size());
+    return numbering->leader[value];
+}
+
+// Reads from the slot of the leader of each value read, where it is there
+static void propagate_copies(Renaming& renaming, struct InstructionNode* node)
+{
+    vector<int*> operands;
+    node_operands(node, operands);
+    for (int i = 0; i < operands.size(); i++)
+    {
+        int value = current(renaming, *operands[i]);
+        int first = leader(renaming, value);
+        int slot = renaming.ssa->values[first].slot;
+        if (first != value && current(renaming, slot) == first)
+            *operands[i] = slot;
+    }
+}
+
+// Leader of the value node is about to write, -1 when it is a new one
+static int number_assign(Renaming& renaming, struct InstructionNode* node)
+{
+    ValueNumbering* numbering = renaming.numbering;
+    int left = leader(renaming, current(renaming, node->assign_inst.operand1_index));
+    if (node->assign_inst.op == OPERATOR_NONE)
+        return left;
+
+    int right = leader(renaming, current(renaming, node->assign_inst.operand2_index));
+    if ((node->assign_inst.op == OPERATOR_PLUS || node->assign_inst.op == OPERATOR_MULT) && right < left)
+        swap(left, right);
+    pair<int, pair<int, int> > key = make_pair((int) node->assign_inst.op, make_pair(left, right));
+
+    map<pair<int, pair<int, int> >, int>::iterator it = numbering->available.find(key);
+    if (it != numbering->available.end())
+    {
+        int slot = renaming.ssa->values[it->second].slot;
+        if (current(renaming, slot) == it->second)
+        {
+            node->assign_inst.op = OPERATOR_NONE;
+            node->assign_inst.operand1_index = slot;
+            return it->second;
+        }
+    }
+    return -1;
+}
+
+static void remember_assign(Renaming& renaming, struct InstructionNode* node, int value)
+{
+    ValueNumbering* numbering = renaming.numbering;
+    int left = leader(renaming, renaming.ssa->uses[node][0]);
+    int right = leader(renaming, renaming.ssa->uses[node][1]);
+    if ((node->assign_inst.op == OPERATOR_PLUS || node->assign_inst.op == OPERATOR_MULT) && right < left)
+        swap(left, right);
+    pair<int, pair<int, int> > key = make_pair((int) node->assign_inst.op, make_pair(left, right));
+
+    map<pair<int, pair<int, int> >, int>::iterator it = numbering->available.find(key);
+    numbering->undo.push_back(make_pair(key, it == numbering->available.end() ? -1 : it->second));
+    numbering->available[key] = value;
+}
+
+static void rename_node(Renaming& renaming, int block, struct InstructionNode* node, vector<int>& pushed)
+{
+    SsaFunction& ssa = *renaming.ssa;
+    int same = -1;
+    if (renaming.numbering != NULL)
+    {
+        propagate_copies(renaming, node);
+        if (node->type == ASSIGN)
+        {
+            same = number_assign(renaming, node);
+            if (same != -1 && node->assign_inst.op == OPERATOR_NONE &&
+                node->assign_inst.operand1_index == node->assign_inst.left_hand_side_index)
+            {
+                // Already holds it
+                node->type = NOOP;
+            }
+        }
+    }
+
+    vector<int> uses;
+    node_uses(node, uses);
+    vector<int>& values = ssa.uses[node];
+    values.clear();
+    for (int i = 0; i < uses.size(); i++)
+        values.push_back(current(renaming, uses[i]));
+
+    int def = node_def(node);
+    if (def == -1)
+        return;
+    int value = new_value(ssa, SSA_NODE, def, block, node);
+    ssa.defs[node] = value;
+    if (renaming.numbering != NULL)
+    {
+        leader(renaming, value);
+        if (same != -1)
+            renaming.numbering->leader[value] = same;
+        else if (node->type == ASSIGN && node->assign_inst.op != OPERATOR_NONE)
+            remember_assign(renaming, node, value);
+    }
+    renaming.stacks[def].push_back(value);
+    pushed.push_back(def);
+}
+
+static void rename_values(SsaFunction& ssa, int frame_size, ValueNumbering* numbering)
+{
+    const ControlFlowGraph& cfg = ssa.cfg;
+    Renaming renaming;
+    renaming.ssa = &ssa;
+    renaming.numbering = numbering;
+    renaming.stacks.assign(frame_size, vector<int>());
+    for (int slot = 0; slot < frame_size; slot++)
+        renaming.stacks[slot].push_back(new_value(ssa, SSA_ENTRY, slot, 0, NULL));
+
+    vector<vector<int> > children(cfg.blocks.size());
+    for (int b = 1; b < cfg.blocks.size(); b++)
+        children[ssa.idom[b]].push_back(b);
+
+    // Blocks are entered when pushed with a positive number and left when
+    // met again as -(b + 1)
+    vector<int> work;
+    vector<vector<int> > pushed(cfg.blocks.size());
+    vector<size_t> undo(cfg.blocks.size(), 0);
+    if (!cfg.blocks.empty())
+        work.push_back(0);
+    while (!work.empty())
+    {
+        int b = work.back();
+        work.pop_back();
+        if (b < 0)
+        {
+            b = -b - 1;
+            for (int i = pushed[b].size() - 1; i >= 0; i--)
+                renaming.stacks[pushed[b][i]].pop_back();
+            if (numbering != NULL)
+            {
+                while (numbering->undo.size() > undo[b])
+                {
+                    if (numbering->undo.back().second == -1)
+                        numbering->available.erase(numbering->undo.back().first);
+                    else
+                        numbering->available[numbering->undo.back().first] = numbering->undo.back().second;
+                    numbering->undo.pop_back();
+                }
+            }
+            continue;
+        }
+
+        if (numbering != NULL)
+            undo[b] = numbering->undo.size();
+        for (int i = 0; i < ssa.phis[b].size(); i++)
+        {
+            int slot = ssa.values[ssa.phis[b][i].value].slot;
+            renaming.stacks[slot].push_back(ssa.phis[b][i].value);
+            pushed[b].push_back(slot);
+        }
+        const BasicBlock& block = cfg.blocks[b];
+        for (int i = 0; i < block.nodes.size(); i++)
+            rename_node(renaming, b, block.nodes[i], pushed[b]);
+
+        for (int i = 0; i < block.successors.size(); i++)
+        {
+            int s = block.successors[i];
+            if (s == EXIT_BLOCK)
+            {
+                if (ssa.function != main_function && block.nodes.back()->type != TAILCALL)
+                    ssa.results.push_back(current(renaming, 0));
+                continue;
+            }
+            for (int p = 0; p < cfg.blocks[s].predecessors.size(); p++)
+            {
+                if (cfg.blocks[s].predecessors[p] != b)
+                    continue;
+                for (int k = 0; k < ssa.phis[s].size(); k++)
+                    ssa.phis[s][k].operands[p] = current(renaming, ssa.values[ssa.phis[s][k].value].slot);
+            }
+        }
+
+        work.push_back(-b - 1);
+        for (int i = 0; i < children[b].size(); i++)
+            work.push_back(children[b][i]);
+    }
+}
+
+static void construct(struct Function* function, SsaFunction& ssa, ValueNumbering* numbering)
+{
+    ssa.function = function;
+    ssa.values.clear();
+    ssa.uses.clear();
+    ssa.defs.clear();
+    ssa.results.clear();
+    build_cfg(function->body, ssa.cfg);
+    compute_dominators(ssa.cfg, ssa.idom);
+
+    // The return value is read after a function ends
+    int frame_size = function->localMem.size();
+    vector<bool> live_at_exit(frame_size, false);
+    if (function != main_function)
+        live_at_exit[0] = true;
+    place_phis(ssa, live_at_exit, numbering == NULL);
+    rename_values(ssa, frame_size, numbering);
+}
+
+void build_ssa(struct Function* function, SsaFunction& ssa)
+{
+    construct(function, ssa, NULL);
+}
+
+// A division that isn't known to succeed has to stay even when its result
+// isn't used
+static bool may_trap(struct InstructionNode* node, const vector<bool>& written, struct Function* function)
+{
+    if (node->type != ASSIGN || node->assign_inst.op != OPERATOR_DIV)
+        return false;
+    int divisor = node->assign_inst.operand2_index;
+    if (written[divisor] || divisor <= function->parameter_count)
+        return true;
+    int value = function->localMem[divisor];
+    return value == 0 || value == -1;
+}
+
+/*
+ * Removes every ASSIGN whose value can't reach a print, a condition, a call
+ * or the return value.
+ */
+static void eliminate_dead_code(struct Function* function)
+{
+    SsaFunction ssa;
+    build_ssa(function, ssa);
+
+    vector<bool> written(function->localMem.size(), false);
+    for (map<InstructionNode*, int>::iterator it = ssa.defs.begin(); it != ssa.defs.end(); it++)
+        written[ssa.values[it->second].slot] = true;
+
+    vector<bool> marked(ssa.values.size(), false);
+    vector<int> work;
+    for (int b = 0; b < ssa.cfg.blocks.size(); b++)
+    {
+        const vector<InstructionNode*>& nodes = ssa.cfg.blocks[b].nodes;
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i]->type == ASSIGN && !may_trap(nodes[i], written, function))
+                continue;
+            const vector<int>& uses = ssa.uses[nodes[i]];
+            work.insert(work.end(), uses.begin(), uses.end());
+        }
+    }
+    work.insert(work.end(), ssa.results.begin(), ssa.results.end());
+
+    while (!work.empty())
+    {
+        int value = work.back();
+        work.pop_back();
+        if (marked[value])
+            continue;
+        marked[value] = true;
+        const SsaValue& v = ssa.values[value];
+        if (v.kind == SSA_NODE)
+        {
+            const vector<int>& uses = ssa.uses[v.node];
+            work.insert(work.end(), uses.begin(), uses.end());
+        }
+        else if (v.kind == SSA_PHI)
+        {
+            const vector<SsaPhi>& phis = ssa.phis[v.block];
+            for (int i = 0; i < phis.size(); i++)
+            {
+                if (phis[i].value == value)
+                    work.insert(work.end(), phis[i].operands.begin(), phis[i].operands.end());
+            }
+        }
+    }
+
+    for (map<InstructionNode*, int>::iterator it = ssa.defs.begin(); it != ssa.defs.end(); it++)
+    {
+        struct InstructionNode* node = it->first;
+        if (node->type == ASSIGN && !marked[it->second] && !may_trap(node, written, function))
+            node->type = NOOP;
+    }
+}
+
+void optimize_ssa(struct Function* function)
+{
+    SsaFunction ssa;
+    ValueNumbering numbering;
+    construct(function, ssa, &numbering);
+    eliminate_dead_code(function);
+}
@@ -0,0 +1,53 @@
+#ifndef __SSA__H__
+#define __SSA__H__
+
+#include <map>
+#include <vector>
+
+#include "compiler.h"
+#include "cfg.h"
+
+using namespace std;
+
+/*
+ * Static single assignment view of a body. Nodes keep using slots; the SSA
+ * form says which value (one per write, per phi and per slot on entry) every
+ * slot a node reads holds there, so passes can reason about values and then
+ * rewrite the nodes.
+ */
+enum SsaValueKind
+{
+    SSA_ENTRY,          // what the slot holds when the body starts
+    SSA_NODE,           // written by node
+    SSA_PHI             // merged at the start of block
+};
+
+struct SsaValue
+{
+    SsaValueKind kind;
+    int slot;
+    int block;
+    struct InstructionNode* node;
+};
+
+struct SsaPhi
+{
+    int value;
+    vector<int> operands;               // one per predecessor of the block, same order
+};
+
+struct SsaFunction
+{
+    struct Function* function;
+    ControlFlowGraph cfg;
+    vector<int> idom;
+    vector<SsaValue> values;
+    vector<vector<SsaPhi> > phis;       // per block
+    map<struct InstructionNode*, vector<int> > uses;   // values read, in node_uses order
+    map<struct InstructionNode*, int> defs;
+    vector<int> results;                // values of slot 0 where a function returns
+};
+
+void build_ssa(struct Function* function, SsaFunction& ssa);
+
+#endif  //__SSA__H__
@@ -0,0 +1,42 @@
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+#include "compiler.h"
+
+using namespace std;
+
+#define STACK_CHUNK     (1 << 16)   // slots committed at a time
+
+static int* reserve_stack()
+{
+    void* range = mmap(NULL, (size_t) STACK_RESERVE * sizeof(int), PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (range == MAP_FAILED)
+    {
+        debug("MEMORY ERROR !!!\nCould not reserve the stack\n");
+        exit(EXIT_FAILURE);
+    }
+    return (int*) range;
+}
+
+int* mem = reserve_stack();
+int stack_limit = 0;
+
+void grow_stack(int top)
+{
+    if (top > STACK_RESERVE)
+    {
+        debug("MEMORY ERROR !!!\nRan out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Newly committed pages read as zero, like the rest of the stack did
+    int limit = (top + STACK_CHUNK - 1) / STACK_CHUNK * STACK_CHUNK;
+    if (mprotect(mem + stack_limit, (size_t) (limit - stack_limit) * sizeof(int), PROT_READ | PROT_WRITE) != 0)
+    {
+        debug("MEMORY ERROR !!!\nRan out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    stack_limit = limit;
+}
@@ -0,0 +1,201 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "compiler.h"
+#include "bytecode.h"
+#include "runtime.h"
+
+using namespace std;
+
+#if defined(__GNUC__)
+
+/*
+ * Direct threaded interpreter. Every instruction stores the address of the
+ * code that implements it, so each handler ends with its own indirect jump
+ * to the handler of the next instruction instead of going back through a
+ * shared switch.
+ */
+void execute_program_threaded(struct BytecodeProgram* program)
+{
+    fuse_superinstructions(program);
+
+    static const void* handlers[OPCODE_COUNT] =
+    {
+        &&do_noop,
+        &&do_print,
+        &&do_assign_none,
+        &&do_assign_plus,
+        &&do_assign_minus,
+        &&do_assign_mult,
+        &&do_assign_div,
+        &&do_cjmp_greater,
+        &&do_cjmp_less,
+        &&do_cjmp_notequal,
+        &&do_jmp,
+        &&do_call,
+        &&do_call_memo,
+        &&do_tailcall,
+        &&do_ret,
+        &&do_halt,
+        &&do_switch_table,
+        &&do_switch_search,
+        &&do_jmp_cjmp_greater,
+        &&do_jmp_cjmp_less,
+        &&do_jmp_cjmp_notequal,
+        &&do_assign_plus_cjmp_greater,
+        &&do_assign_plus_cjmp_less,
+        &&do_assign_plus_cjmp_notequal,
+        &&do_assign_minus_cjmp_greater,
+        &&do_assign_minus_cjmp_less,
+        &&do_assign_minus_cjmp_notequal,
+        &&do_assign_none_print,
+        &&do_assign_plus_print,
+        &&do_assign_minus_print,
+        &&do_assign_mult_print,
+        &&do_assign_div_print
+    };
+
+    for (int i = 0; i < program->code.size(); i++)
+    {
+        program->code[i].handler = handlers[program->code[i].opcode];
+    }
+
+    Instruction* code = &program->code[0];
+    Instruction* pc = code + program->entry;
+    int* fp = mem + frame_pointer;
+
+#define DISPATCH() goto *pc->handler
+#define NEXT() do { pc++; DISPATCH(); } while (0)
+
+    DISPATCH();
+
+do_noop:
+    NEXT();
+do_print:
+    printf("%d ", fp[pc->a]);
+    NEXT();
+do_assign_none:
+    fp[pc->a] = fp[pc->b];
+    NEXT();
+do_assign_plus:
+    fp[pc->a] = fp[pc->b] + fp[pc->c];
+    NEXT();
+do_assign_minus:
+    fp[pc->a] = fp[pc->b] - fp[pc->c];
+    NEXT();
+do_assign_mult:
+    fp[pc->a] = fp[pc->b] * fp[pc->c];
+    NEXT();
+do_assign_div:
+    fp[pc->a] = fp[pc->b] / fp[pc->c];
+    NEXT();
+do_cjmp_greater:
+    pc = fp[pc->b] > fp[pc->c] ? code + pc->a : code + pc->target;
+    DISPATCH();
+do_cjmp_less:
+    pc = fp[pc->b] < fp[pc->c] ? code + pc->a : code + pc->target;
+    DISPATCH();
+do_cjmp_notequal:
+    pc = fp[pc->b] != fp[pc->c] ? code + pc->a : code + pc->target;
+    DISPATCH();
+do_jmp:
+    pc = code + pc->target;
+    DISPATCH();
+do_call:
+    pc = code + call_function(program, pc, pc - code + 1);
+    fp = mem + frame_pointer;
+    DISPATCH();
+do_call_memo:
+    pc = code + call_function_memo(program, pc, pc - code + 1);
+    fp = mem + frame_pointer;
+    DISPATCH();
+do_tailcall:
+    pc = code + tail_call_function(program, pc);
+    DISPATCH();
+do_ret:
+    pc = code + return_from_function(program);
+    fp = mem + frame_pointer;
+    DISPATCH();
+do_halt:
+    return;
+do_switch_table:
+{
+    unsigned entry = (unsigned) fp[pc->a] - (unsigned) pc->c;
+    pc = entry < (unsigned) pc->d ? code + program->case_targets[pc->b + entry] : pc + 1;
+    DISPATCH();
+}
+do_switch_search:
+    pc = code + switch_target(program, pc, fp[pc->a]);
+    DISPATCH();
+
+    // The second half of a superinstruction is reached with a plain goto, so
+    // the pair costs a single dispatch.
+do_jmp_cjmp_greater:
+    pc = fp[pc->b] > fp[pc->c] ? code + pc->a : code + pc->target;
+    DISPATCH();
+do_jmp_cjmp_less:
+    pc = fp[pc->b] < fp[pc->c] ? code + pc->a : code + pc->target;
+    DISPATCH();
+do_jmp_cjmp_notequal:
+    pc = fp[pc->b] != fp[pc->c] ? code + pc->a : code + pc->target;
+    DISPATCH();
+do_assign_plus_cjmp_greater:
+    fp[pc->a] = fp[pc->b] + fp[pc->c];
+    pc++;
+    goto do_jmp_cjmp_greater;
+do_assign_plus_cjmp_less:
+    fp[pc->a] = fp[pc->b] + fp[pc->c];
+    pc++;
+    goto do_jmp_cjmp_less;
+do_assign_plus_cjmp_notequal:
+    fp[pc->a] = fp[pc->b] + fp[pc->c];
+    pc++;
+    goto do_jmp_cjmp_notequal;
+do_assign_minus_cjmp_greater:
+    fp[pc->a] = fp[pc->b] - fp[pc->c];
+    pc++;
+    goto do_jmp_cjmp_greater;
+do_assign_minus_cjmp_less:
+    fp[pc->a] = fp[pc->b] - fp[pc->c];
+    pc++;
+    goto do_jmp_cjmp_less;
+do_assign_minus_cjmp_notequal:
+    fp[pc->a] = fp[pc->b] - fp[pc->c];
+    pc++;
+    goto do_jmp_cjmp_notequal;
+do_assign_none_print:
+    fp[pc->a] = fp[pc->b];
+    pc++;
+    goto do_print;
+do_assign_plus_print:
+    fp[pc->a] = fp[pc->b] + fp[pc->c];
+    pc++;
+    goto do_print;
+do_assign_minus_print:
+    fp[pc->a] = fp[pc->b] - fp[pc->c];
+    pc++;
+    goto do_print;
+do_assign_mult_print:
+    fp[pc->a] = fp[pc->b] * fp[pc->c];
+    pc++;
+    goto do_print;
+do_assign_div_print:
+    fp[pc->a] = fp[pc->b] / fp[pc->c];
+    pc++;
+    goto do_print;
+
+#undef NEXT
+#undef DISPATCH
+}
+
+#else
+
+// Labels as values are a GNU extension; other compilers get the switch
+// interpreter.
+void execute_program_threaded(struct BytecodeProgram* program)
+{
+    execute_program(program, NULL);
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "compiler.h"
+#include "bytecode.h"
+#include "runtime.h"
+#include "jit.h"
+
+using namespace std;
+
+#define HOT_LOOP 1000           // backward jumps to a loop before it is recorded
+#define MAX_TRACE_LENGTH 1000   // steps a recording may take before it gives up
+#define MAX_INLINE_DEPTH 8      // calls a recording may go into
+
+/*
+ * State of the trace being recorded. It starts at header, in the frame at
+ * entry_frame, and is done when it gets back there.
+ */
+struct Recording
+{
+    bool active;
+    int header;
+    int entry_frame;
+    int depth;                          // calls entered and not returned from
+    vector<TraceStep> steps;
+};
+
+// Runs the trace from the current frame and returns the index the
+// interpreter goes on at, with the frames the trace was inside set up
+static int run_trace(struct BytecodeProgram* program, struct CompiledTrace* trace)
+{
+    int base = frame_pointer;
+    ensure_stack(base + trace->extent);
+    const TraceExit& exit = trace->exits[trace->code(mem + base)];
+    for (int i = 0; i < exit.calls.size(); i++)
+    {
+        int call_pc = exit.calls[i].first;
+        int callee_frame = base + exit.calls[i].second + program->code[call_pc].d;
+        mem[callee_frame - 2] = base + exit.calls[i].second;
+        mem[callee_frame - 1] = call_pc + 1;
+    }
+    frame_pointer = base + exit.offset;
+    return exit.pc;
+}
+
+// Whether the recording can go on past the step it just added
+static bool record_step(struct Recording& recording, const Instruction* inst, int value_matched)
+{
+    switch (inst->opcode)
+    {
+        case OP_CALL:
+            recording.depth++;
+            break;
+        case OP_RET:
+            if (recording.depth == 0)
+                return false;
+            recording.depth--;
+            break;
+        case OP_SWITCH_TABLE:
+        case OP_SWITCH_SEARCH:
+            // The default can't be guarded with one comparison
+            if (!value_matched)
+                return false;
+            break;
+        case OP_CALL_MEMO:
+        case OP_TAILCALL:
+            return false;
+    }
+    return recording.depth <= MAX_INLINE_DEPTH && recording.steps.size() <= MAX_TRACE_LENGTH;
+}
+
+/*
+ * Switch interpreter that counts the backward jumps to every loop. Once a
+ * loop is hot the next iteration is recorded and compiled (compile_trace in
+ * jit.cc), and from then on every jump back to it runs the trace instead.
+ * A loop whose recording fails, or can't be compiled, is left to the
+ * interpreter.
+ */
+void execute_program_traced(struct BytecodeProgram* program)
+{
+    const Instruction* code = &program->code[0];
+    vector<int> hotness(program->code.size(), 0);
+    vector<bool> blacklisted(program->code.size(), false);
+    vector<struct CompiledTrace*> traces(program->code.size(), (struct CompiledTrace*) NULL);
+    struct Recording recording;
+    recording.active = false;
+
+    int pc = program->entry;
+    while (true)
+    {
+        const Instruction* inst = &code[pc];
+        int frame = frame_pointer;
+        int next;
+        int value = 0;
+        bool value_matched = false;
+        switch (inst->opcode)
+        {
+            case OP_CALL:
+                next = call_function(program, inst, pc + 1);
+                break;
+            case OP_CALL_MEMO:
+                next = call_function_memo(program, inst, pc + 1);
+                break;
+            case OP_TAILCALL:
+                next = tail_call_function(program, inst);
+                break;
+            case OP_NOOP:
+                next = pc + 1;
+                break;
+            case OP_PRINT:
+                printf("%d ", mem[frame_pointer + inst->a]);
+                next = pc + 1;
+                break;
+            case OP_ASSIGN_NONE:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b];
+                next = pc + 1;
+                break;
+            case OP_ASSIGN_PLUS:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] + mem[frame_pointer + inst->c];
+                next = pc + 1;
+                break;
+            case OP_ASSIGN_MINUS:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] - mem[frame_pointer + inst->c];
+                next = pc + 1;
+                break;
+            case OP_ASSIGN_MULT:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] * mem[frame_pointer + inst->c];
+                next = pc + 1;
+                break;
+            case OP_ASSIGN_DIV:
+                mem[frame_pointer + inst->a] = mem[frame_pointer + inst->b] / mem[frame_pointer + inst->c];
+                next = pc + 1;
+                break;
+            case OP_CJMP_GREATER:
+                next = mem[frame_pointer + inst->b] > mem[frame_pointer + inst->c] ? inst->a : inst->target;
+                break;
+            case OP_CJMP_LESS:
+                next = mem[frame_pointer + inst->b] < mem[frame_pointer + inst->c] ? inst->a : inst->target;
+                break;
+            case OP_CJMP_NOTEQUAL:
+                next = mem[frame_pointer + inst->b] != mem[frame_pointer + inst->c] ? inst->a : inst->target;
+                break;
+            case OP_JMP:
+                next = inst->target;
+                break;
+            case OP_SWITCH_TABLE:
+            case OP_SWITCH_SEARCH:
+                value = mem[frame_pointer + inst->a];
+                value_matched = switch_entry(program, inst, value) != -1;
+                next = switch_target(program, inst, value);
+                break;
+            case OP_RET: // Return from function
+                next = return_from_function(program);
+                break;
+            case OP_HALT:
+                return;
+            default:
+                debug("Error: invalid value for inst->opcode (%d).\n", inst->opcode);
+                exit(EXIT_FAILURE);
+                break;
+        }
+
+        if (recording.active)
+        {
+            TraceStep step;
+            step.pc = pc;
+            step.offset = frame - recording.entry_frame;
+            step.next = next;
+            step.value = value;
+            recording.steps.push_back(step);
+            if (!record_step(recording, inst, value_matched))
+            {
+                blacklisted[recording.header] = true;
+                recording.active = false;
+            }
+            else if (next == recording.header && frame_pointer == recording.entry_frame)
+            {
+                traces[next] = compile_trace(program, recording.steps);
+                if (traces[next] == NULL)
+                    blacklisted[next] = true;
+                recording.active = false;
+            }
+        }
+        else if (inst->opcode == OP_JMP && next <= pc)
+        {
+            if (traces[next] != NULL)
+            {
+                pc = run_trace(program, traces[next]);
+                continue;
+            }
+            if (!blacklisted[next] && ++hotness[next] == HOT_LOOP)
+            {
+                recording.active = true;
+                recording.header = next;
+                recording.entry_frame = frame_pointer;
+                recording.depth = 0;
+                recording.steps.clear();
+            }
+        }
+        pc = next;
+    }
+}